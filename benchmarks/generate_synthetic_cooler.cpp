@@ -0,0 +1,94 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+// Generate a synthetic .cool file used to benchmark queries on files that are larger than the test
+// datasets shipped with hictkR.
+// Interactions follow a power-law decay with the distance from the diagonal, and counts are drawn
+// from a seeded PRNG, so that the same file is generated on every build.
+//
+// Usage: generate_synthetic_cooler <output.cool> [resolution] [num_chroms] [chrom_size]
+// [max_distance]
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <hictk/cooler/cooler.hpp>
+#include <hictk/pixel.hpp>
+#include <hictk/reference.hpp>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <output.cool> [resolution] [num_chroms] [chrom_size] [max_distance]\n";
+    return 1;
+  }
+
+  try {
+    const std::string path{argv[1]};
+    const auto resolution = argc > 2 ? static_cast<std::uint32_t>(std::stoul(argv[2])) : 10'000U;
+    const auto num_chroms = argc > 3 ? static_cast<std::uint32_t>(std::stoul(argv[3])) : 4U;
+    const auto chrom_size =
+        argc > 4 ? static_cast<std::uint32_t>(std::stoul(argv[4])) : 50'000'000U;
+    const auto max_distance =
+        argc > 5 ? static_cast<std::uint64_t>(std::stoull(argv[5])) : std::uint64_t{500};
+
+    std::vector<std::string> chrom_names{};
+    std::vector<std::uint32_t> chrom_sizes{};
+    for (std::uint32_t i = 0; i < num_chroms; ++i) {
+      chrom_names.emplace_back("chr" + std::to_string(i + 1));
+      chrom_sizes.push_back(chrom_size);
+    }
+
+    auto clr = hictk::cooler::File::create<std::int32_t>(
+        path, hictk::Reference{chrom_names.begin(), chrom_names.end(), chrom_sizes.begin()},
+        resolution, true);
+
+    std::mt19937_64 rand_eng{123456789};
+    std::vector<hictk::ThinPixel<std::int32_t>> buffer{};
+    const auto &bins = clr.bins();
+
+    for (const auto &chrom : bins.chromosomes()) {
+      const auto first_bin = bins.at(chrom, 0).id();
+      const auto last_bin = bins.at(chrom, chrom.size() - 1).id() + 1;
+      for (auto bin1_id = first_bin; bin1_id < last_bin; ++bin1_id) {
+        buffer.clear();
+        for (auto bin2_id = bin1_id; bin2_id < std::min(bin1_id + max_distance, last_bin);
+             ++bin2_id) {
+          const auto expected = 1000.0 / std::pow(static_cast<double>(bin2_id - bin1_id + 1), 1.1);
+          std::poisson_distribution<std::int32_t> dist{expected};
+          const auto count = dist(rand_eng);
+          if (count != 0) {
+            buffer.push_back(hictk::ThinPixel<std::int32_t>{bin1_id, bin2_id, count});
+          }
+        }
+        clr.append_pixels(buffer.begin(), buffer.end());
+      }
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "failed to generate synthetic file: " << e.what() << "\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,253 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+// Benchmarks for the C++ layer of hictkR.
+// Benchmarks run inside an embedded R session, as most of the code under test allocates R objects.
+// Throughput is reported both as rows (or matrix cells) per second and as bytes per second, where
+// the number of bytes refers to the size of the R objects being returned.
+
+#include <Rcpp.h>
+#include <Rembedded.h>
+#include <arrow/table.h>
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/file.hpp>
+#include <hictk/transformers/to_dataframe.hpp>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "./common.h"
+#include "./hictkr_arrow.h"
+#include "./hictkr_file.h"
+#include "./hictkr_singlecell_file.h"
+
+namespace {
+struct Dataset {
+  std::string name;
+  std::string path;
+  std::uint32_t resolution;
+  // Query used to benchmark dense fetches: genome-wide queries are only practical on small files
+  std::optional<std::string> dense_query;
+};
+}  // namespace
+
+[[nodiscard]] static std::int64_t r_object_size(SEXP x) {
+  switch (TYPEOF(x)) {
+    case VECSXP: {
+      std::int64_t size = 0;
+      for (R_xlen_t i = 0; i < Rf_xlength(x); ++i) {
+        size += r_object_size(VECTOR_ELT(x, i));
+      }
+      return size;
+    }
+    case LGLSXP:
+      [[fallthrough]];
+    case INTSXP:
+      return static_cast<std::int64_t>(Rf_xlength(x) * sizeof(int));
+    case REALSXP:
+      return static_cast<std::int64_t>(Rf_xlength(x) * sizeof(double));
+    case STRSXP:
+      return static_cast<std::int64_t>(Rf_xlength(x) * sizeof(SEXP));
+    default:
+      return 0;
+  }
+}
+
+[[nodiscard]] static std::int64_t num_rows(SEXP df) {
+  return Rf_xlength(df) == 0 ? 0 : Rf_xlength(VECTOR_ELT(df, 0));
+}
+
+static void report(benchmark::State &state, std::int64_t rows, std::int64_t bytes) {
+  state.counters["rows/s"] =
+      benchmark::Counter(static_cast<double>(rows), benchmark::Counter::kIsRate);
+  state.SetBytesProcessed(bytes);
+}
+
+static void bm_fetch_df(benchmark::State &state, const Dataset &dataset, bool join) {
+  const HiCFile f(dataset.path, static_cast<std::int64_t>(dataset.resolution));
+
+  std::int64_t rows = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto df = f.fetch_df(R_NilValue, R_NilValue, R_NilValue, "int", join, "UCSC",
+                               "upper_triangle", R_NilValue, R_NilValue, 1, false);
+    rows += num_rows(df);
+    bytes += r_object_size(df);
+  }
+  report(state, rows, bytes);
+}
+
+static void bm_fetch_dense(benchmark::State &state, const Dataset &dataset) {
+  const HiCFile f(dataset.path, static_cast<std::int64_t>(dataset.resolution));
+  const auto query = dataset.dense_query.has_value()
+                         ? Rcpp::Nullable<Rcpp::String>{Rcpp::wrap(*dataset.dense_query)}
+                         : Rcpp::Nullable<Rcpp::String>{R_NilValue};
+
+  std::int64_t cells = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto m = f.fetch_dense(query, query, R_NilValue, "int", "UCSC", "full", R_NilValue,
+                                 false, R_NilValue, 1, false);
+    cells += Rf_xlength(m);
+    bytes += r_object_size(m);
+  }
+  report(state, cells, bytes);
+}
+
+static void bm_bins(benchmark::State &state, const Dataset &dataset) {
+  // Benchmark get_bins() directly, as HiCFile::bins() caches its result
+  const hictk::File f(dataset.path, dataset.resolution);
+
+  std::int64_t rows = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto df = get_bins(f);
+    rows += num_rows(df);
+    bytes += r_object_size(df);
+  }
+  report(state, rows, bytes);
+}
+
+static void bm_attributes(benchmark::State &state, const Dataset &dataset) {
+  const HiCFile f(dataset.path, static_cast<std::int64_t>(dataset.resolution));
+
+  std::int64_t rows = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto attrs = f.attributes();
+    rows += Rf_xlength(attrs);
+    bytes += r_object_size(attrs);
+  }
+  report(state, rows, bytes);
+}
+
+static void bm_arrow_to_df(benchmark::State &state, const Dataset &dataset, bool join) {
+  const hictk::File f(dataset.path, dataset.resolution);
+  const auto format =
+      join ? hictk::transformers::DataFrameFormat::BG2 : hictk::transformers::DataFrameFormat::COO;
+
+  const auto table = std::visit(
+      [&](const auto &ff) {
+        const auto sel = ff.fetch(hictk::balancing::Method::NONE());
+        return hictk::transformers::ToDataFrame(sel, sel.template end<std::int32_t>(), format,
+                                                sel.bins_ptr())();
+      },
+      f.get());
+
+  std::int64_t rows = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto df = arrow_table_to_df(table);
+    rows += num_rows(df);
+    bytes += r_object_size(df);
+  }
+  report(state, rows, bytes);
+}
+
+static void bm_fetch_pseudobulk(benchmark::State &state, const std::string &path) {
+  const SingleCellFile f(path);
+
+  std::int64_t rows = 0;
+  std::int64_t bytes = 0;
+  for (auto _ : state) {
+    const auto df = f.fetch(R_NilValue, R_NilValue, R_NilValue, R_NilValue, "int", false, "UCSC",
+                            true);
+    rows += num_rows(df);
+    bytes += r_object_size(df);
+  }
+  report(state, rows, bytes);
+}
+
+static void register_benchmarks(const std::vector<Dataset> &datasets,
+                                const std::string &scool_path) {
+  for (const auto &dataset : datasets) {
+    const auto prefix = dataset.name + "/";
+    benchmark::RegisterBenchmark(prefix + "fetch_df/COO", bm_fetch_df, dataset, false);
+    benchmark::RegisterBenchmark(prefix + "fetch_df/BG2", bm_fetch_df, dataset, true);
+    benchmark::RegisterBenchmark(prefix + "fetch_dense", bm_fetch_dense, dataset);
+    benchmark::RegisterBenchmark(prefix + "bins", bm_bins, dataset);
+    benchmark::RegisterBenchmark(prefix + "attributes", bm_attributes, dataset);
+    benchmark::RegisterBenchmark(prefix + "arrow_to_df/COO", bm_arrow_to_df, dataset, false);
+    benchmark::RegisterBenchmark(prefix + "arrow_to_df/BG2", bm_arrow_to_df, dataset, true);
+  }
+
+  benchmark::RegisterBenchmark("scool/fetch_pseudobulk", bm_fetch_pseudobulk, scool_path);
+}
+
+static void init_embedded_r() {
+  if (!std::getenv("R_HOME")) {
+#ifdef _WIN32
+    _putenv_s("R_HOME", HICTKR_R_HOME);
+#else
+    setenv("R_HOME", HICTKR_R_HOME, 0);
+#endif
+  }
+
+  std::string arg0{"hictkR_bench"};
+  std::string arg1{"--vanilla"};
+  std::string arg2{"--silent"};
+  std::vector<char *> args{arg0.data(), arg1.data(), arg2.data()};
+  Rf_initEmbeddedR(static_cast<int>(args.size()), args.data());
+
+  // Rcpp looks up its runtime through the Rcpp namespace, which should thus be loaded
+  int error = 0;
+  SEXP call = PROTECT(Rf_lang2(Rf_install("loadNamespace"), Rf_mkString("Rcpp")));
+  R_tryEval(call, R_GlobalEnv, &error);
+  UNPROTECT(1);
+  if (error != 0) {
+    throw std::runtime_error("failed to load the Rcpp namespace");
+  }
+}
+
+int main(int argc, char **argv) {
+  const std::filesystem::path test_data_dir{HICTKR_TEST_DATA_DIR};
+
+  const std::vector<Dataset> datasets{
+      {"hic", (test_data_dir / "hic_test_file.hic").string(), 100'000, std::nullopt},
+      {"mcool", (test_data_dir / "cooler_test_file.mcool").string(), 100'000, std::nullopt},
+      {"synthetic_cool", HICTKR_SYNTHETIC_COOLER, 10'000, "chr1"}};
+
+  try {
+    init_embedded_r();
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+
+  register_benchmarks(datasets, (test_data_dir / "cooler_test_file.scool").string());
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+
+  Rf_endEmbeddedR(0);
+  return 0;
+}
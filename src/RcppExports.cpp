@@ -15,7 +15,9 @@ RcppExport SEXP _rcpp_module_boot_hictkR();
 static const R_CallMethodDef CallEntries[] = {
     {"_rcpp_module_boot_hictkR", (DL_FUNC)&_rcpp_module_boot_hictkR, 0}, {NULL, NULL, 0}};
 
+void register_altrep_classes(DllInfo* dll);
 RcppExport void R_init_hictkR(DllInfo* dll) {
   R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
   R_useDynamicSymbols(dll, FALSE);
+  register_altrep_classes(dll);
 }
@@ -20,7 +20,10 @@
 
 #include <Rcpp.h>
 
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 template <typename File>
@@ -39,24 +42,68 @@ template <typename File>
                                  Rcpp::Named("size") = chrom_sizes);
 }
 
+// Generate the bin table for bins of fixed size directly from the chromosome sizes.
+// Returns false when the bin table does not have a fixed resolution.
+template <typename BinTable>
+[[nodiscard]] bool fill_fixed_bins(const BinTable& bins, int* chrom_ids, double* starts,
+                                   double* ends) {
+  const auto resolution = static_cast<std::uint64_t>(bins.resolution());
+  if (resolution == 0) {
+    return false;
+  }
+
+  std::uint64_t num_bins = 0;
+  for (const auto& chrom : bins.chromosomes()) {
+    if (!chrom.is_all()) {
+      num_bins += (chrom.size() + resolution - 1) / resolution;
+    }
+  }
+  if (num_bins != bins.size()) {
+    return false;
+  }
+
+  std::size_t i = 0;
+  for (const auto& chrom : bins.chromosomes()) {
+    if (chrom.is_all()) {
+      continue;
+    }
+    const auto chrom_id = static_cast<int>(chrom.id()) + 1;
+    const auto chrom_size = static_cast<std::uint64_t>(chrom.size());
+    for (std::uint64_t start = 0; start < chrom_size; start += resolution, ++i) {
+      chrom_ids[i] = chrom_id;
+      starts[i] = static_cast<double>(start);
+      ends[i] = static_cast<double>(std::min(start + resolution, chrom_size));
+    }
+  }
+
+  return true;
+}
+
 template <typename File>
 [[nodiscard]] Rcpp::DataFrame get_bins(const File& f) {
-  Rcpp::CharacterVector chrom_names{};
-  for (const auto& chrom : f.chromosomes()) {
-    chrom_names.push_back(std::string{chrom.name()});
+  const auto& chromosomes = f.chromosomes();
+  Rcpp::CharacterVector chrom_names(static_cast<R_xlen_t>(chromosomes.size()));
+  R_xlen_t chrom_idx = 0;
+  for (const auto& chrom : chromosomes) {
+    chrom_names[chrom_idx++] = std::string{chrom.name()};
   }
 
-  std::vector<std::uint32_t> chrom_ids{};
-  std::vector<std::uint32_t> starts{};
-  std::vector<std::uint32_t> ends{};
+  const auto& bins = f.bins();
+  const auto num_bins = static_cast<R_xlen_t>(bins.size());
 
-  for (const auto& bin : f.bins()) {
-    chrom_ids.push_back(bin.chrom().id() + 1);
-    starts.push_back(bin.start());
-    ends.push_back(bin.end());
-  }
+  Rcpp::IntegerVector chroms(Rcpp::no_init(num_bins));
+  Rcpp::NumericVector starts(Rcpp::no_init(num_bins));
+  Rcpp::NumericVector ends(Rcpp::no_init(num_bins));
 
-  Rcpp::IntegerVector chroms(chrom_ids.begin(), chrom_ids.end());
+  if (!fill_fixed_bins(bins, chroms.begin(), starts.begin(), ends.begin())) {
+    R_xlen_t i = 0;
+    for (const auto& bin : bins) {
+      chroms[i] = static_cast<int>(bin.chrom().id()) + 1;
+      starts[i] = static_cast<double>(bin.start());
+      ends[i] = static_cast<double>(bin.end());
+      ++i;
+    }
+  }
 
   chroms.attr("class") = "factor";
   chroms.attr("levels") = chrom_names;
@@ -64,3 +111,12 @@ template <typename File>
   return Rcpp::DataFrame::create(Rcpp::Named("chrom") = chroms, Rcpp::Named("start") = starts,
                                  Rcpp::Named("end") = ends);
 }
+
+// Mark a data.frame and its columns as not mutable, so that it can be safely cached and returned
+// to R multiple times: R code modifying the data.frame will then operate on a copy.
+inline void mark_not_mutable(Rcpp::DataFrame& df) {
+  for (R_xlen_t i = 0; i < df.size(); ++i) {
+    MARK_NOT_MUTABLE(VECTOR_ELT(df, i));
+  }
+  MARK_NOT_MUTABLE(df);
+}
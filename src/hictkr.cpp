@@ -21,9 +21,14 @@
 #include <cstdint>
 #include <string>
 
+#include "./hictkr_cooler_writer.h"
+#include "./hictkr_fetch_future.h"
 #include "./hictkr_file.h"
+#include "./hictkr_handle_pool.h"
 #include "./hictkr_multi_resolution_file.h"
+#include "./hictkr_pixel_stream.h"
 #include "./hictkr_singlecell_file.h"
+#include "./hictkr_tile_cache.h"
 #include "./hictkr_validation.h"
 
 RCPP_MODULE(hictkR) {
@@ -33,6 +38,18 @@ RCPP_MODULE(hictkR) {
   Rcpp::function("Rcpp_is_scool_file", &is_scool_file,
                  "Test whether a file is a single-cell Cooler.");
   Rcpp::function("Rcpp_is_hic_file", &is_hic_file, "Test whether a file is in .hic format.");
+  Rcpp::function("Rcpp_handle_pool_stats", &handle_pool_stats,
+                 "Get statistics about the process-wide pool of file handles.");
+  Rcpp::function("Rcpp_set_handle_pool_size", &set_handle_pool_size,
+                 "Set the maximum number of file handles kept open by the pool.");
+  Rcpp::function("Rcpp_clear_handle_pool", &clear_handle_pool,
+                 "Close all file handles held by the pool and reset its statistics.");
+  Rcpp::function("Rcpp_tile_cache_stats", &tile_cache_stats,
+                 "Get statistics about the process-wide tile cache.");
+  Rcpp::function("Rcpp_configure_tile_cache", &configure_tile_cache,
+                 "Set the size and location of the tile cache.");
+  Rcpp::function("Rcpp_clear_tile_cache", &clear_tile_cache,
+                 "Drop all tiles cached in memory and reset the statistics of the tile cache.");
 
   Rcpp::class_<HiCFile>("RcppHiCFile")
       .constructor<std::string, std::string, std::string>()
@@ -47,14 +64,54 @@ RCPP_MODULE(hictkR) {
       .property("nchroms", &HiCFile::nchroms, "Number of chromosomes.")
       .property("attributes", &HiCFile::attributes, "File attributes.")
       .property("normalizations", &HiCFile::avail_normalizations, "Normalizations available.")
+      .const_method("expected_values", &HiCFile::expected_values,
+                    "Compute the expected interactions of each diagonal of the cis matrices.")
+      .const_method("marginals", &HiCFile::marginals,
+                    "Compute the sum of the interactions of each bin.")
+      .const_method("cis_trans_summary", &HiCFile::cis_trans_summary,
+                    "Compute the total number of cis and trans interactions.")
+      .const_method("chrom_sums", &HiCFile::chrom_sums,
+                    "Compute the sum of the interactions of each pair of chromosomes.")
+      .const_method("pileup", &HiCFile::pileup,
+                    "Aggregate the interactions surrounding a set of anchor pairs.")
+      .method("balance", &HiCFile::balance,
+              "Compute balancing weights, optionally writing them back to the file.")
       .const_method("fetch_df", &HiCFile::fetch_df, "Fetch interactions as a DataFrame.")
-      .const_method("fetch_dense", &HiCFile::fetch_dense, "Fetch interactions as a Matrix.");
+      .const_method("fetch_arrow", &HiCFile::fetch_arrow,
+                    "Fetch interactions as a nanoarrow_array_stream.")
+      .const_method("fetch_batch", &HiCFile::fetch_batch,
+                    "Fetch interactions for a batch of queries as DataFrames.")
+      .const_method("fetch_stream", &HiCFile::fetch_stream,
+                    "Fetch interactions as a stream of DataFrames.")
+      .const_method("fetch_async", &HiCFile::fetch_async,
+                    "Fetch interactions in the background.")
+      .const_method("fetch_to_file", &HiCFile::fetch_to_file,
+                    "Write interactions to a file without loading them in memory.")
+      .const_method("fetch_dense", &HiCFile::fetch_dense, "Fetch interactions as a Matrix.")
+      .const_method("fetch_sparse", &HiCFile::fetch_sparse,
+                    "Fetch interactions as a sparse Matrix.");
+
+  Rcpp::class_<PixelStream>("RcppPixelStream")
+      .property("done", &PixelStream::done, "Whether all pixels have been read.")
+      .property("chunk_size", &PixelStream::chunk_size, "Maximum number of pixels per chunk.")
+      .property("chunks_read", &PixelStream::chunks_read, "Number of chunks read so far.")
+      .method("next_chunk", &PixelStream::next_chunk, "Fetch the next chunk of interactions.");
+
+  Rcpp::class_<FetchFuture>("RcppFetchFuture")
+      .method("ready", &FetchFuture::ready, "Whether the query has been processed.")
+      .method("wait", &FetchFuture::wait, "Wait for the query to be processed.")
+      .method("value", &FetchFuture::value, "Get the result of the query.");
 
   Rcpp::class_<MultiResFile>("RcppMultiResFile")
       .constructor<std::string>()
       .property("path", &MultiResFile::path, "Path to the opened file.")
       .property("chromosomes", &MultiResFile::chromosomes)
-      .property("resolutions", &MultiResFile::resolutions);
+      .property("resolutions", &MultiResFile::resolutions)
+      .const_method("fetch", &MultiResFile::fetch,
+                    "Fetch interactions at the finest resolution fitting the given number of "
+                    "pixels.")
+      .const_method("tile", &MultiResFile::tile,
+                    "Fetch a fixed-size tile of genome-wide interactions at the given zoom level.");
 
   Rcpp::class_<SingleCellFile>("RcppSingleCellFile")
       .constructor<std::string>()
@@ -64,5 +121,22 @@ RCPP_MODULE(hictkR) {
       .property("chromosomes", &SingleCellFile::chromosomes)
       .property("bins", &SingleCellFile::bins)
       .property("attributes", &SingleCellFile::attributes, "File attributes.")
-      .property("cells", &SingleCellFile::cells);
+      .property("cells", &SingleCellFile::cells)
+      .const_method("fetch", &SingleCellFile::fetch,
+                    "Fetch interactions for a set of cells, optionally aggregating them.");
+
+  Rcpp::class_<CoolerWriter>("RcppCoolerWriter")
+      .constructor<std::string, Rcpp::DataFrame, std::int64_t, std::string, std::int64_t, int,
+                   bool>()
+      .property("path", &CoolerWriter::path, "Path to the output file.")
+      .property("resolution", &CoolerWriter::resolution, "Bin size in bp.")
+      .property("chunk_size", &CoolerWriter::chunk_size,
+                "Maximum number of pixels buffered in memory.")
+      .property("pixels_added", &CoolerWriter::pixels_added, "Number of pixels added so far.")
+      .property("chunks_written", &CoolerWriter::chunks_written,
+                "Number of chunks spilled to temporary files so far.")
+      .property("finalized", &CoolerWriter::finalized, "Whether the writer has been finalized.")
+      .method("add_pixels", &CoolerWriter::add_pixels,
+              "Add pixels from a data.frame or nanoarrow_array_stream.")
+      .method("finalize", &CoolerWriter::finalize, "Write all pixels to the output file.");
 }
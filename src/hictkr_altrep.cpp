@@ -0,0 +1,372 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_altrep.h"
+
+#include <Rcpp.h>
+// Altrep.h relies on the definitions from the R headers included by Rcpp.h
+#include <R_ext/Altrep.h>
+#include <arrow/array.h>
+#include <arrow/array/concatenate.h>
+#include <arrow/chunked_array.h>
+#include <arrow/type.h>
+#include <arrow/type_traits.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./hictkr_arrow.h"
+
+namespace {
+
+// State shared by all lazy columns. The state is owned by the external pointer stored in the
+// data1 slot of each ALTREP object, while the data2 slot stores the materialized vector (if any)
+struct LazyColumn {
+  std::shared_ptr<arrow::ChunkedArray> column{};
+  std::shared_ptr<arrow::Schema> schema{};
+  // Offset of the first element of each chunk
+  std::vector<std::int64_t> offsets{};
+  // Only used by dictionary columns: map the dictionary values of each chunk to factor codes
+  std::vector<std::vector<int>> codes{};
+  std::int64_t length{};
+  bool zero_copy{};
+};
+
+R_altrep_class_t lazy_integer_class{};
+R_altrep_class_t lazy_real_class{};
+
+[[nodiscard]] LazyColumn &get_state(SEXP x) {
+  auto *state = static_cast<LazyColumn *>(R_ExternalPtrAddr(R_altrep_data1(x)));
+  assert(state);
+  return *state;
+}
+
+[[nodiscard]] bool is_materialized(SEXP x) { return R_altrep_data2(x) != R_NilValue; }
+
+// ALTREP methods are called from C code: exceptions must not cross the boundary with R
+template <typename Fn>
+auto call_and_rethrow_as_r_error(Fn &&fn) -> decltype(fn()) {
+  char msg[1024]{};
+  try {
+    return fn();
+  } catch (const std::exception &e) {
+    std::snprintf(msg, sizeof(msg), "%s", e.what());
+  } catch (...) {
+    std::snprintf(msg, sizeof(msg), "unknown error while converting an Arrow column");
+  }
+  Rf_error("%s", msg);
+}
+
+SEXP materialize(SEXP x) {
+  if (is_materialized(x)) {
+    return R_altrep_data2(x);
+  }
+
+  auto &state = get_state(x);
+  SEXP vect = PROTECT(call_and_rethrow_as_r_error(
+      [&]() -> SEXP { return arrow_column_to_r(state.column, state.schema); }));
+  R_set_altrep_data2(x, vect);
+  UNPROTECT(1);
+
+  // Elements are now read from the materialized vector, so the Arrow buffers can be released.
+  // The only exception are zero-copy columns: pointers to their Arrow buffers previously returned
+  // by lazy_column_dataptr_or_null() may still be in use
+  if (!state.zero_copy) {
+    state.column.reset();
+    state.codes.clear();
+  }
+  return vect;
+}
+
+// Call fn with the typed array wrapped by the given numeric chunk
+template <typename Fn>
+auto visit_numeric_array(const arrow::Array &chunk, Fn &&fn) {
+  switch (chunk.type_id()) {
+    case arrow::Type::INT8:
+      return fn(static_cast<const arrow::Int8Array &>(chunk));
+    case arrow::Type::UINT8:
+      return fn(static_cast<const arrow::UInt8Array &>(chunk));
+    case arrow::Type::INT16:
+      return fn(static_cast<const arrow::Int16Array &>(chunk));
+    case arrow::Type::UINT16:
+      return fn(static_cast<const arrow::UInt16Array &>(chunk));
+    case arrow::Type::INT32:
+      return fn(static_cast<const arrow::Int32Array &>(chunk));
+    case arrow::Type::UINT32:
+      return fn(static_cast<const arrow::UInt32Array &>(chunk));
+    case arrow::Type::INT64:
+      return fn(static_cast<const arrow::Int64Array &>(chunk));
+    case arrow::Type::UINT64:
+      return fn(static_cast<const arrow::UInt64Array &>(chunk));
+    case arrow::Type::FLOAT:
+      return fn(static_cast<const arrow::FloatArray &>(chunk));
+    default:
+      assert(chunk.type_id() == arrow::Type::DOUBLE);
+      return fn(static_cast<const arrow::DoubleArray &>(chunk));
+  }
+}
+
+template <typename T>
+[[nodiscard]] T get_element(const LazyColumn &state, R_xlen_t i, T na_value) {
+  const auto match = std::upper_bound(state.offsets.begin(), state.offsets.end(),
+                                      static_cast<std::int64_t>(i));
+  assert(match != state.offsets.begin());
+  const auto chunk_id = static_cast<std::size_t>(std::distance(state.offsets.begin(), match) - 1);
+  const auto j = static_cast<std::int64_t>(i) - state.offsets[chunk_id];
+
+  const auto &chunk = *state.column->chunk(static_cast<int>(chunk_id));
+  if (chunk.IsNull(j)) {
+    return na_value;
+  }
+
+  if (chunk.type_id() == arrow::Type::DICTIONARY) {
+    const auto &array = static_cast<const arrow::DictionaryArray &>(chunk);
+    return static_cast<T>(state.codes[chunk_id][static_cast<std::size_t>(array.GetValueIndex(j))]);
+  }
+
+  return visit_numeric_array(chunk,
+                             [&](const auto &array) { return static_cast<T>(array.Value(j)); });
+}
+
+[[nodiscard]] const void *get_zero_copy_dataptr(const LazyColumn &state) {
+  if (!state.zero_copy) {
+    return nullptr;
+  }
+  const auto &chunk = *state.column->chunk(0);
+  if (chunk.type_id() == arrow::Type::INT32) {
+    return static_cast<const arrow::Int32Array &>(chunk).raw_values();
+  }
+  return static_cast<const arrow::DoubleArray &>(chunk).raw_values();
+}
+
+R_xlen_t lazy_column_length(SEXP x) {
+  if (is_materialized(x)) {
+    return Rf_xlength(R_altrep_data2(x));
+  }
+  return static_cast<R_xlen_t>(get_state(x).length);
+}
+
+Rboolean lazy_column_inspect(SEXP x, [[maybe_unused]] int pre, [[maybe_unused]] int deep,
+                             [[maybe_unused]] int pvec,
+                             [[maybe_unused]] void (*inspect_subtree)(SEXP, int, int, int)) {
+  const auto &state = get_state(x);
+  Rprintf("hictkR lazy Arrow column (len=%lld, materialized=%s, zero-copy=%s)\n",
+          static_cast<long long>(state.length), is_materialized(x) ? "TRUE" : "FALSE",
+          state.zero_copy ? "TRUE" : "FALSE");
+  return TRUE;
+}
+
+[[nodiscard]] void *get_dataptr(SEXP vect) {
+  if (TYPEOF(vect) == INTSXP) {
+    return INTEGER(vect);
+  }
+  return REAL(vect);
+}
+
+const void *lazy_column_dataptr_or_null(SEXP x) {
+  if (is_materialized(x)) {
+    return get_dataptr(R_altrep_data2(x));
+  }
+  return get_zero_copy_dataptr(get_state(x));
+}
+
+void *lazy_column_dataptr(SEXP x, Rboolean writeable) {
+  if (!writeable && !is_materialized(x)) {
+    // Arrow buffers are immutable: only hand them out for read-only access
+    if (const auto *ptr = get_zero_copy_dataptr(get_state(x)); ptr) {
+      return const_cast<void *>(ptr);  // NOLINT(*-const-cast)
+    }
+  }
+  return get_dataptr(materialize(x));
+}
+
+int lazy_column_no_na(SEXP x) {
+  if (is_materialized(x)) {
+    return 0;
+  }
+  return get_state(x).column->null_count() == 0;
+}
+
+int lazy_integer_elt(SEXP x, R_xlen_t i) {
+  if (is_materialized(x)) {
+    return INTEGER_ELT(R_altrep_data2(x), i);
+  }
+  return get_element(get_state(x), i, NA_INTEGER);
+}
+
+double lazy_real_elt(SEXP x, R_xlen_t i) {
+  if (is_materialized(x)) {
+    return REAL_ELT(R_altrep_data2(x), i);
+  }
+  return get_element(get_state(x), i, NA_REAL);
+}
+
+R_xlen_t lazy_integer_get_region(SEXP x, R_xlen_t i, R_xlen_t n, int *buf) {
+  if (is_materialized(x)) {
+    return INTEGER_GET_REGION(R_altrep_data2(x), i, n, buf);
+  }
+  const auto &state = get_state(x);
+  const auto size = std::min(n, static_cast<R_xlen_t>(state.length) - i);
+  for (R_xlen_t k = 0; k < size; ++k) {
+    buf[k] = get_element(state, i + k, NA_INTEGER);
+  }
+  return size;
+}
+
+R_xlen_t lazy_real_get_region(SEXP x, R_xlen_t i, R_xlen_t n, double *buf) {
+  if (is_materialized(x)) {
+    return REAL_GET_REGION(R_altrep_data2(x), i, n, buf);
+  }
+  const auto &state = get_state(x);
+  const auto size = std::min(n, static_cast<R_xlen_t>(state.length) - i);
+  for (R_xlen_t k = 0; k < size; ++k) {
+    buf[k] = get_element(state, i + k, NA_REAL);
+  }
+  return size;
+}
+
+// Columns with the same memory layout as R vectors can only be handed out to R without copying
+// when they are backed by a single buffer: combining the chunks requires a copy in Arrow memory,
+// but saves R from allocating a new vector every time the data is accessed
+[[nodiscard]] std::shared_ptr<arrow::ChunkedArray> combine_chunks(
+    const arrow::ChunkedArray &column) {
+  auto res = arrow::Concatenate(column.chunks());
+  if (!res.ok()) {
+    throw std::runtime_error(fmt::format(FMT_STRING("Failed to concatenate arrow::Arrays: {}"),
+                                         res.status().message()));
+  }
+  return std::make_shared<arrow::ChunkedArray>(res.MoveValueUnsafe());
+}
+
+[[nodiscard]] bool is_string_dictionary(const arrow::DataType &type) {
+  const auto &dict_type = static_cast<const arrow::DictionaryType &>(type);
+  return arrow::is_integer(dict_type.index_type()->id()) &&
+         dict_type.value_type()->id() == arrow::Type::STRING;
+}
+
+// Map the dictionary values of each chunk onto the (1-based) codes of an R factor.
+// Levels are registered in the same order used by arrow_column_to_r(), so that materializing the
+// column yields the same codes.
+[[nodiscard]] std::vector<std::string> map_dictionaries_to_levels(LazyColumn &state) {
+  std::vector<std::string> levels{};
+  std::unordered_map<std::string, int> level_ids{};
+
+  state.codes.reserve(static_cast<std::size_t>(state.column->num_chunks()));
+  for (const auto &chunk : state.column->chunks()) {
+    const auto &array = static_cast<const arrow::DictionaryArray &>(*chunk);
+    const auto &dictionary = static_cast<const arrow::StringArray &>(*array.dictionary());
+    auto &codes = state.codes.emplace_back(static_cast<std::size_t>(dictionary.length()));
+    for (std::int64_t i = 0; i < dictionary.length(); ++i) {
+      const auto value = dictionary.GetView(i);
+      auto [it, inserted] = level_ids.try_emplace(std::string{value.data(), value.size()},
+                                                  static_cast<int>(levels.size()) + 1);
+      if (inserted) {
+        levels.push_back(it->first);
+      }
+      codes[static_cast<std::size_t>(i)] = it->second;
+    }
+  }
+
+  return levels;
+}
+
+}  // namespace
+
+// ALTREP classes are registered when the package is loaded
+// [[Rcpp::init]]
+void register_altrep_classes(DllInfo *dll) {
+  lazy_integer_class = R_make_altinteger_class("hictkR_lazy_integer", "hictkR", dll);
+  R_set_altrep_Length_method(lazy_integer_class, lazy_column_length);
+  R_set_altrep_Inspect_method(lazy_integer_class, lazy_column_inspect);
+  R_set_altvec_Dataptr_method(lazy_integer_class, lazy_column_dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_integer_class, lazy_column_dataptr_or_null);
+  R_set_altinteger_Elt_method(lazy_integer_class, lazy_integer_elt);
+  R_set_altinteger_Get_region_method(lazy_integer_class, lazy_integer_get_region);
+  R_set_altinteger_No_NA_method(lazy_integer_class, lazy_column_no_na);
+
+  lazy_real_class = R_make_altreal_class("hictkR_lazy_real", "hictkR", dll);
+  R_set_altrep_Length_method(lazy_real_class, lazy_column_length);
+  R_set_altrep_Inspect_method(lazy_real_class, lazy_column_inspect);
+  R_set_altvec_Dataptr_method(lazy_real_class, lazy_column_dataptr);
+  R_set_altvec_Dataptr_or_null_method(lazy_real_class, lazy_column_dataptr_or_null);
+  R_set_altreal_Elt_method(lazy_real_class, lazy_real_elt);
+  R_set_altreal_Get_region_method(lazy_real_class, lazy_real_get_region);
+  R_set_altreal_No_NA_method(lazy_real_class, lazy_column_no_na);
+}
+
+SEXP arrow_column_to_altrep(std::shared_ptr<arrow::ChunkedArray> column,
+                            const std::shared_ptr<arrow::Schema> &schema) {
+  assert(column);
+
+  const auto type_id = column->type()->id();
+  const auto is_dictionary =
+      type_id == arrow::Type::DICTIONARY && is_string_dictionary(*column->type());
+  const auto is_integer = is_dictionary || type_id == arrow::Type::INT8 ||
+                          type_id == arrow::Type::UINT8 || type_id == arrow::Type::INT16 ||
+                          type_id == arrow::Type::UINT16 || type_id == arrow::Type::INT32;
+  const auto is_real = type_id == arrow::Type::UINT32 || type_id == arrow::Type::INT64 ||
+                       type_id == arrow::Type::UINT64 || type_id == arrow::Type::FLOAT ||
+                       type_id == arrow::Type::DOUBLE;
+
+  if (!is_integer && !is_real) {
+    return arrow_column_to_r(std::move(column), schema);
+  }
+
+  const auto has_r_layout = type_id == arrow::Type::INT32 || type_id == arrow::Type::DOUBLE;
+  if (has_r_layout && column->num_chunks() > 1 && column->null_count() == 0) {
+    column = combine_chunks(*column);
+  }
+
+  auto state = std::make_unique<LazyColumn>();
+  state->length = column->length();
+  state->zero_copy = has_r_layout && column->num_chunks() == 1 && column->null_count() == 0;
+  state->offsets.reserve(static_cast<std::size_t>(column->num_chunks()));
+  std::int64_t offset = 0;
+  for (const auto &chunk : column->chunks()) {
+    state->offsets.push_back(offset);
+    offset += chunk->length();
+  }
+  state->column = std::move(column);
+  state->schema = schema;
+
+  const auto levels =
+      is_dictionary ? map_dictionaries_to_levels(*state) : std::vector<std::string>{};
+
+  const Rcpp::XPtr<LazyColumn> data1{state.release(), true};
+  Rcpp::RObject vect{
+      R_new_altrep(is_integer ? lazy_integer_class : lazy_real_class, data1, R_NilValue)};
+
+  if (is_dictionary) {
+    vect.attr("levels") = Rcpp::CharacterVector(levels.begin(), levels.end());
+    vect.attr("class") = "factor";
+  }
+
+  return vect;
+}
@@ -0,0 +1,38 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+#include <arrow/chunked_array.h>
+#include <arrow/type_fwd.h>
+
+#include <memory>
+
+// Wrap an arrow::ChunkedArray as an ALTREP vector.
+// Elements are read straight from the Arrow buffers, and the column is converted to a regular R
+// vector only when R requires a pointer to its data (the Arrow buffers are then released).
+// Chunked int32 or double columns without nulls are combined into a single chunk, which is handed
+// out to R without copying: these columns are only converted to regular R vectors when modified.
+// Columns with types that have no ALTREP representation are converted eagerly with
+// arrow_column_to_r().
+[[nodiscard]] SEXP arrow_column_to_altrep(std::shared_ptr<arrow::ChunkedArray> column,
+                                          const std::shared_ptr<arrow::Schema> &schema);
+
+// Register the ALTREP classes used by arrow_column_to_altrep(). Called by R_init_hictkR()
+void register_altrep_classes(DllInfo *dll);
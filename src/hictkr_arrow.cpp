@@ -0,0 +1,528 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_arrow.h"
+
+#include <Rcpp.h>
+#include <arrow/array.h>
+#include <arrow/array/util.h>
+#include <arrow/c/abi.h>
+#include <arrow/c/bridge.h>
+#include <arrow/chunked_array.h>
+#include <arrow/io/file.h>
+#include <arrow/record_batch.h>
+#include <arrow/ipc/writer.h>
+#include <arrow/scalar.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+#include <arrow/type_traits.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "./hictkr_altrep.h"
+
+void arrow_schema_deleter(ArrowSchema *schema) noexcept {
+  try {
+    if (schema->release) {
+      schema->release(schema);
+    }
+    free(schema);
+  } catch (...) {  // NOLINT
+  }
+}
+
+void arrow_array_stream_deleter(ArrowArrayStream *stream) noexcept {
+  try {
+    if (stream->release) {
+      stream->release(stream);
+    }
+    free(stream);
+  } catch (...) {  // NOLINT
+  }
+}
+
+ArrowSchemaXPtr export_arrow_schema(const std::shared_ptr<arrow::Schema> &schema_in) {
+  auto *schema = static_cast<ArrowSchema *>(malloc(sizeof(ArrowSchema)));
+  if (!schema) {
+    throw std::bad_alloc();
+  }
+
+  const auto status = arrow::ExportSchema(*schema_in, schema);
+  if (!status.ok()) {
+    free(schema);
+    throw std::runtime_error(fmt::format(
+        FMT_STRING("Failed to export arrow::Schema as ArrowSchema: {}"), status.message()));
+  }
+
+  ArrowSchemaXPtr ptr{schema, true};
+  ptr.attr("class") = "nanoarrow_schema";
+  return ptr;
+}
+
+ArrowArrayStreamXPtr export_arrow_array_stream(std::shared_ptr<arrow::ChunkedArray> column,
+                                               const ArrowSchemaXPtr &schema) {
+  auto *array_stream = static_cast<ArrowArrayStream *>(malloc(sizeof(ArrowArrayStream)));
+  if (!array_stream) {
+    throw std::bad_alloc();
+  }
+
+  const auto status = arrow::ExportChunkedArray(std::move(column), array_stream);
+  if (!status.ok()) {
+    free(array_stream);
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Failed to export arrow::ChunkedArray as ArrowArrayStream: {}"),
+                    status.message()));
+  }
+
+  ArrowArrayStreamXPtr ptr{array_stream, true};
+  ptr.attr("class") = "nanoarrow_array_stream";
+  ptr.attr("schema") = schema;
+  return ptr;
+}
+
+ArrowArrayStreamXPtr export_arrow_table(std::shared_ptr<arrow::Table> table) {
+  assert(table);
+  auto *array_stream = static_cast<ArrowArrayStream *>(malloc(sizeof(ArrowArrayStream)));
+  if (!array_stream) {
+    throw std::bad_alloc();
+  }
+
+  auto reader = std::make_shared<arrow::TableBatchReader>(std::move(table));
+  const auto status = arrow::ExportRecordBatchReader(std::move(reader), array_stream);
+  if (!status.ok()) {
+    free(array_stream);
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Failed to export arrow::Table as ArrowArrayStream: {}"),
+                    status.message()));
+  }
+
+  ArrowArrayStreamXPtr ptr{array_stream, true};
+  ptr.attr("class") = "nanoarrow_array_stream";
+  return ptr;
+}
+
+std::shared_ptr<arrow::RecordBatchReader> import_arrow_array_stream(SEXP stream) {
+  if (!Rf_inherits(stream, "nanoarrow_array_stream") || TYPEOF(stream) != EXTPTRSXP) {
+    throw std::invalid_argument("stream should be a nanoarrow_array_stream");
+  }
+
+  auto *array_stream = static_cast<ArrowArrayStream *>(R_ExternalPtrAddr(stream));
+  if (!array_stream || !array_stream->release) {
+    throw std::invalid_argument("nanoarrow_array_stream has already been released");
+  }
+
+  auto reader = arrow::ImportRecordBatchReader(array_stream);
+  if (!reader.ok()) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Failed to import nanoarrow_array_stream: {}"),
+                    reader.status().message()));
+  }
+  return reader.MoveValueUnsafe();
+}
+
+enum class DataFrameConverter : std::uint8_t { native, nanoarrow, altrep };
+
+[[nodiscard]] static DataFrameConverter get_df_converter() {
+  const Rcpp::RObject opt{Rf_GetOption1(Rf_install("hictkR.df_converter"))};
+  if (opt.isNULL()) {
+    return DataFrameConverter::native;
+  }
+
+  const auto converter = Rcpp::as<std::string>(opt);
+  if (converter == "native") {
+    return DataFrameConverter::native;
+  }
+  if (converter == "nanoarrow") {
+    return DataFrameConverter::nanoarrow;
+  }
+  if (converter == "altrep") {
+    return DataFrameConverter::altrep;
+  }
+
+  throw std::invalid_argument(fmt::format(
+      FMT_STRING("invalid hictkR.df_converter option \"{}\": should be one of \"native\", "
+                 "\"nanoarrow\", or \"altrep\""),
+      converter));
+}
+
+[[nodiscard]] static SEXP convert_column_with_nanoarrow(std::shared_ptr<arrow::ChunkedArray> column,
+                                                        const ArrowSchemaXPtr &schema) {
+  auto nanoarrow = Rcpp::Environment::namespace_env("nanoarrow");
+  const Rcpp::Function nanoarrow_convert_array_stream{nanoarrow["convert_array_stream"]};
+
+  return nanoarrow_convert_array_stream(export_arrow_array_stream(std::move(column), schema));
+}
+
+[[nodiscard]] static Rcpp::DataFrame arrow_table_to_df_nanoarrow(
+    const std::shared_ptr<arrow::Table> &arrow_table) {
+  assert(arrow_table);
+
+  auto schema_r = export_arrow_schema(arrow_table->schema());
+  const auto col_names = arrow_table->ColumnNames();
+
+  Rcpp::List columns_r(arrow_table->num_columns());
+
+  for (R_xlen_t i = 0; i < columns_r.size(); ++i) {
+    columns_r[i] = convert_column_with_nanoarrow(arrow_table->column(static_cast<int>(i)), schema_r);
+  }
+
+  columns_r.attr("names") = Rcpp::CharacterVector(col_names.begin(), col_names.end());
+
+  auto base = Rcpp::Environment::base_namespace();
+  const Rcpp::Function as_data_frame = base["as.data.frame"];
+
+  return as_data_frame(columns_r);
+}
+
+template <typename ArrowArrayT, typename T>
+static T *copy_chunk(const arrow::Array &chunk, T *dest, T na_value) {
+  const auto &array = static_cast<const ArrowArrayT &>(chunk);
+  const auto *src = array.raw_values();
+  const auto size = array.length();
+
+  if (array.null_count() == 0) {
+    std::transform(src, src + size, dest, [](const auto n) { return static_cast<T>(n); });
+  } else {
+    for (std::int64_t i = 0; i < size; ++i) {
+      dest[i] = array.IsNull(i) ? na_value : static_cast<T>(src[i]);
+    }
+  }
+
+  return dest + size;
+}
+
+template <typename ArrowArrayT>
+[[nodiscard]] static SEXP to_integer_vector(const arrow::ChunkedArray &column) {
+  Rcpp::IntegerVector vect(Rcpp::no_init(static_cast<R_xlen_t>(column.length())));
+  auto *dest = vect.begin();
+  for (const auto &chunk : column.chunks()) {
+    dest = copy_chunk<ArrowArrayT>(*chunk, dest, NA_INTEGER);
+  }
+  return vect;
+}
+
+template <typename ArrowArrayT>
+[[nodiscard]] static SEXP to_numeric_vector(const arrow::ChunkedArray &column) {
+  Rcpp::NumericVector vect(Rcpp::no_init(static_cast<R_xlen_t>(column.length())));
+  auto *dest = vect.begin();
+  for (const auto &chunk : column.chunks()) {
+    dest = copy_chunk<ArrowArrayT>(*chunk, dest, NA_REAL);
+  }
+  return vect;
+}
+
+template <typename ArrowArrayT>
+[[nodiscard]] static SEXP to_character_vector(const arrow::ChunkedArray &column) {
+  Rcpp::CharacterVector vect(static_cast<R_xlen_t>(column.length()));
+  R_xlen_t i = 0;
+  for (const auto &chunk : column.chunks()) {
+    const auto &array = static_cast<const ArrowArrayT &>(*chunk);
+    for (std::int64_t j = 0; j < array.length(); ++j, ++i) {
+      if (array.IsNull(j)) {
+        vect[i] = NA_STRING;
+      } else {
+        const auto value = array.GetView(j);
+        vect[i] = Rcpp::String(std::string{value.data(), value.size()});
+      }
+    }
+  }
+  return vect;
+}
+
+// Map the values of a dictionary onto the (1-based) codes of an R factor, registering new levels
+// as they are encountered
+template <typename ArrowArrayT>
+static void map_dictionary_to_levels(const arrow::Array &dictionary,
+                                     std::vector<std::string> &levels,
+                                     std::unordered_map<std::string, int> &level_ids,
+                                     std::vector<int> &codes) {
+  const auto &array = static_cast<const ArrowArrayT &>(dictionary);
+
+  codes.resize(static_cast<std::size_t>(array.length()));
+  for (std::int64_t i = 0; i < array.length(); ++i) {
+    const auto value = array.GetView(i);
+    auto [it, inserted] = level_ids.try_emplace(std::string{value.data(), value.size()},
+                                                static_cast<int>(levels.size()) + 1);
+    if (inserted) {
+      levels.push_back(it->first);
+    }
+    codes[static_cast<std::size_t>(i)] = it->second;
+  }
+}
+
+template <typename ArrowArrayT>
+static int *copy_dictionary_indices(const arrow::Array &indices, const std::vector<int> &codes,
+                                    int *dest) {
+  const auto &array = static_cast<const ArrowArrayT &>(indices);
+  const auto *src = array.raw_values();
+  for (std::int64_t i = 0; i < array.length(); ++i) {
+    dest[i] = array.IsNull(i) ? NA_INTEGER : codes[static_cast<std::size_t>(src[i])];
+  }
+  return dest + array.length();
+}
+
+[[nodiscard]] static bool is_supported_dictionary(const arrow::DataType &type) {
+  const auto &dict_type = static_cast<const arrow::DictionaryType &>(type);
+  const auto value_type = dict_type.value_type()->id();
+  return arrow::is_integer(dict_type.index_type()->id()) &&
+         (value_type == arrow::Type::STRING || value_type == arrow::Type::LARGE_STRING);
+}
+
+[[nodiscard]] static SEXP to_factor(const arrow::ChunkedArray &column) {
+  Rcpp::IntegerVector factor(Rcpp::no_init(static_cast<R_xlen_t>(column.length())));
+
+  std::vector<std::string> levels{};
+  std::unordered_map<std::string, int> level_ids{};
+  std::vector<int> codes{};
+
+  auto *dest = factor.begin();
+  for (const auto &chunk : column.chunks()) {
+    const auto &array = static_cast<const arrow::DictionaryArray &>(*chunk);
+    const auto &dictionary = *array.dictionary();
+    if (dictionary.type_id() == arrow::Type::STRING) {
+      map_dictionary_to_levels<arrow::StringArray>(dictionary, levels, level_ids, codes);
+    } else {
+      map_dictionary_to_levels<arrow::LargeStringArray>(dictionary, levels, level_ids, codes);
+    }
+
+    const auto &indices = *array.indices();
+    switch (indices.type_id()) {
+      case arrow::Type::INT8:
+        dest = copy_dictionary_indices<arrow::Int8Array>(indices, codes, dest);
+        break;
+      case arrow::Type::UINT8:
+        dest = copy_dictionary_indices<arrow::UInt8Array>(indices, codes, dest);
+        break;
+      case arrow::Type::INT16:
+        dest = copy_dictionary_indices<arrow::Int16Array>(indices, codes, dest);
+        break;
+      case arrow::Type::UINT16:
+        dest = copy_dictionary_indices<arrow::UInt16Array>(indices, codes, dest);
+        break;
+      case arrow::Type::INT32:
+        dest = copy_dictionary_indices<arrow::Int32Array>(indices, codes, dest);
+        break;
+      case arrow::Type::UINT32:
+        dest = copy_dictionary_indices<arrow::UInt32Array>(indices, codes, dest);
+        break;
+      case arrow::Type::INT64:
+        dest = copy_dictionary_indices<arrow::Int64Array>(indices, codes, dest);
+        break;
+      case arrow::Type::UINT64:
+        dest = copy_dictionary_indices<arrow::UInt64Array>(indices, codes, dest);
+        break;
+      default:
+        throw std::runtime_error(
+            fmt::format(FMT_STRING("unsupported dictionary index type: {}"),
+                        indices.type()->ToString()));
+    }
+  }
+
+  factor.attr("levels") = Rcpp::CharacterVector(levels.begin(), levels.end());
+  factor.attr("class") = "factor";
+
+  return factor;
+}
+
+SEXP arrow_column_to_r(std::shared_ptr<arrow::ChunkedArray> column,
+                       const std::shared_ptr<arrow::Schema> &schema) {
+  assert(column);
+  switch (column->type()->id()) {
+    case arrow::Type::INT8:
+      return to_integer_vector<arrow::Int8Array>(*column);
+    case arrow::Type::UINT8:
+      return to_integer_vector<arrow::UInt8Array>(*column);
+    case arrow::Type::INT16:
+      return to_integer_vector<arrow::Int16Array>(*column);
+    case arrow::Type::UINT16:
+      return to_integer_vector<arrow::UInt16Array>(*column);
+    case arrow::Type::INT32:
+      return to_integer_vector<arrow::Int32Array>(*column);
+    case arrow::Type::UINT32:
+      return to_numeric_vector<arrow::UInt32Array>(*column);
+    case arrow::Type::INT64:
+      return to_numeric_vector<arrow::Int64Array>(*column);
+    case arrow::Type::UINT64:
+      return to_numeric_vector<arrow::UInt64Array>(*column);
+    case arrow::Type::FLOAT:
+      return to_numeric_vector<arrow::FloatArray>(*column);
+    case arrow::Type::DOUBLE:
+      return to_numeric_vector<arrow::DoubleArray>(*column);
+    case arrow::Type::STRING:
+      return to_character_vector<arrow::StringArray>(*column);
+    case arrow::Type::LARGE_STRING:
+      return to_character_vector<arrow::LargeStringArray>(*column);
+    case arrow::Type::DICTIONARY:
+      if (is_supported_dictionary(*column->type())) {
+        return to_factor(*column);
+      }
+      [[fallthrough]];
+    default:
+      return convert_column_with_nanoarrow(std::move(column), export_arrow_schema(schema));
+  }
+}
+
+Rcpp::DataFrame arrow_table_to_df(std::shared_ptr<arrow::Table> arrow_table) {
+  assert(arrow_table);
+
+  const auto converter = get_df_converter();
+  if (converter == DataFrameConverter::nanoarrow) {
+    return arrow_table_to_df_nanoarrow(arrow_table);
+  }
+
+  const auto num_rows = arrow_table->num_rows();
+  if (num_rows > std::numeric_limits<int>::max()) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("unable to convert a table with {} rows to a data.frame: data.frames "
+                               "cannot have more than {} rows"),
+                    num_rows, std::numeric_limits<int>::max()));
+  }
+
+  const auto col_names = arrow_table->ColumnNames();
+  const auto schema = arrow_table->schema();
+
+  // Take ownership of the columns so that each column can be released as soon as it has been
+  // converted, instead of waiting for the entire table to be converted
+  auto columns = arrow_table->columns();
+  arrow_table.reset();
+
+  Rcpp::List columns_r(static_cast<R_xlen_t>(columns.size()));
+  for (std::size_t i = 0; i < columns.size(); ++i) {
+    auto &column = columns[i];
+    columns_r[static_cast<R_xlen_t>(i)] = converter == DataFrameConverter::altrep
+                                              ? arrow_column_to_altrep(std::move(column), schema)
+                                              : arrow_column_to_r(std::move(column), schema);
+  }
+
+  columns_r.attr("names") = Rcpp::CharacterVector(col_names.begin(), col_names.end());
+  columns_r.attr("class") = "data.frame";
+  columns_r.attr("row.names") =
+      Rcpp::IntegerVector::create(NA_INTEGER, -static_cast<int>(num_rows));
+
+  return Rcpp::DataFrame(columns_r);
+}
+
+std::shared_ptr<arrow::Table> concat_arrow_tables(
+    const std::vector<std::shared_ptr<arrow::Table>> &tables, const std::string &id_column) {
+  if (tables.empty()) {
+    throw std::invalid_argument("unable to concatenate an empty list of tables");
+  }
+
+  auto res = arrow::ConcatenateTables(tables);
+  if (!res.ok()) {
+    throw std::runtime_error(fmt::format(FMT_STRING("Failed to concatenate arrow::Tables: {}"),
+                                         res.status().message()));
+  }
+  auto table = res.MoveValueUnsafe();
+
+  if (id_column.empty()) {
+    return table;
+  }
+
+  arrow::ArrayVector ids(tables.size());
+  for (std::size_t i = 0; i < tables.size(); ++i) {
+    auto ids_res = arrow::MakeArrayFromScalar(arrow::Int32Scalar(static_cast<std::int32_t>(i + 1)),
+                                              tables[i]->num_rows());
+    if (!ids_res.ok()) {
+      throw std::runtime_error(fmt::format(FMT_STRING("Failed to allocate arrow::Array: {}"),
+                                           ids_res.status().message()));
+    }
+    ids[i] = ids_res.MoveValueUnsafe();
+  }
+
+  auto table_res =
+      table->AddColumn(0, arrow::field(id_column, arrow::int32()),
+                       std::make_shared<arrow::ChunkedArray>(std::move(ids), arrow::int32()));
+  if (!table_res.ok()) {
+    throw std::runtime_error(fmt::format(FMT_STRING("Failed to add column to arrow::Table: {}"),
+                                         table_res.status().message()));
+  }
+
+  return table_res.MoveValueUnsafe();
+}
+
+ArrowIpcFileWriter::ArrowIpcFileWriter(std::string path,
+                                       const std::shared_ptr<arrow::Schema> &schema)
+    : _path(std::move(path)) {
+  auto sink = arrow::io::FileOutputStream::Open(_path);
+  if (!sink.ok()) {
+    throw std::runtime_error(fmt::format(FMT_STRING("Failed to open file \"{}\" for writing: {}"),
+                                         _path, sink.status().message()));
+  }
+  _sink = sink.MoveValueUnsafe();
+
+  auto writer = arrow::ipc::MakeFileWriter(_sink, schema);
+  if (!writer.ok()) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Failed to initialize Arrow IPC writer for file \"{}\": {}"), _path,
+                    writer.status().message()));
+  }
+  _writer = writer.MoveValueUnsafe();
+}
+
+ArrowIpcFileWriter::~ArrowIpcFileWriter() noexcept {
+  try {
+    close();
+  } catch (...) {  // NOLINT
+  }
+}
+
+std::int64_t ArrowIpcFileWriter::rows_written() const noexcept { return _rows_written; }
+
+void ArrowIpcFileWriter::write(const arrow::Table &table) {
+  if (!_writer) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Arrow IPC writer for file \"{}\" has already been closed"), _path));
+  }
+
+  const auto status = _writer->WriteTable(table);
+  if (!status.ok()) {
+    throw std::runtime_error(fmt::format(FMT_STRING("Failed to write table to file \"{}\": {}"),
+                                         _path, status.message()));
+  }
+  _rows_written += table.num_rows();
+}
+
+void ArrowIpcFileWriter::close() {
+  if (!_writer) {
+    return;
+  }
+
+  auto writer = std::move(_writer);
+  auto sink = std::move(_sink);
+
+  auto status = writer->Close();
+  if (status.ok()) {
+    status = sink->Close();
+  }
+  if (!status.ok()) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("Failed to close file \"{}\": {}"), _path, status.message()));
+  }
+}
@@ -0,0 +1,98 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+#include <arrow/c/abi.h>
+#include <arrow/chunked_array.h>
+#include <arrow/io/type_fwd.h>
+#include <arrow/ipc/type_fwd.h>
+#include <arrow/record_batch.h>
+#include <arrow/table.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+void arrow_schema_deleter(ArrowSchema *schema) noexcept;
+void arrow_array_stream_deleter(ArrowArrayStream *stream) noexcept;
+
+using ArrowSchemaXPtr = Rcpp::XPtr<ArrowSchema, Rcpp::PreserveStorage, arrow_schema_deleter>;
+using ArrowArrayStreamXPtr =
+    Rcpp::XPtr<ArrowArrayStream, Rcpp::PreserveStorage, arrow_array_stream_deleter>;
+
+[[nodiscard]] ArrowSchemaXPtr export_arrow_schema(const std::shared_ptr<arrow::Schema> &schema_in);
+[[nodiscard]] ArrowArrayStreamXPtr export_arrow_array_stream(
+    std::shared_ptr<arrow::ChunkedArray> column, const ArrowSchemaXPtr &schema);
+
+// Export an arrow::Table as a nanoarrow_array_stream yielding the record batches backing the
+// table. Record batches are not copied: the table is kept alive until the stream is released.
+[[nodiscard]] ArrowArrayStreamXPtr export_arrow_table(std::shared_ptr<arrow::Table> table);
+
+// Import a nanoarrow_array_stream as an arrow::RecordBatchReader.
+// The stream is moved into the returned reader, and is thus released by the time this function
+// returns.
+[[nodiscard]] std::shared_ptr<arrow::RecordBatchReader> import_arrow_array_stream(SEXP stream);
+
+// Convert an arrow::ChunkedArray to an R vector.
+// Types are mapped following the same rules used by nanoarrow::convert_array_stream(). Columns with
+// types that are not natively supported are converted using nanoarrow.
+[[nodiscard]] SEXP arrow_column_to_r(std::shared_ptr<arrow::ChunkedArray> column,
+                                     const std::shared_ptr<arrow::Schema> &schema);
+
+// Convert an arrow::Table to a data.frame.
+// Columns are copied straight into pre-allocated R vectors and released as soon as they have been
+// converted. Columns with types that are not natively supported are converted using nanoarrow.
+// Setting options(hictkR.df_converter = "nanoarrow") forces all columns to go through nanoarrow,
+// while options(hictkR.df_converter = "altrep") defers the conversion of each column until the
+// column is accessed (see arrow_column_to_altrep()).
+[[nodiscard]] Rcpp::DataFrame arrow_table_to_df(std::shared_ptr<arrow::Table> arrow_table);
+
+// Concatenate tables sharing the same schema.
+// When id_column is not empty, a column with the given name is prepended to the result. The column
+// stores the (1-based) index of the table each row originates from.
+[[nodiscard]] std::shared_ptr<arrow::Table> concat_arrow_tables(
+    const std::vector<std::shared_ptr<arrow::Table>> &tables, const std::string &id_column = "");
+
+// Write arrow::Tables to a file using the Arrow IPC file format (also known as Feather V2).
+// Tables are written as they are received, so that large query results can be exported without
+// ever being materialized in memory. This class does not interact with the R API.
+class ArrowIpcFileWriter {
+  std::string _path{};
+  std::shared_ptr<arrow::io::FileOutputStream> _sink{};
+  std::shared_ptr<arrow::ipc::RecordBatchWriter> _writer{};
+  std::int64_t _rows_written{};
+
+ public:
+  ArrowIpcFileWriter(std::string path, const std::shared_ptr<arrow::Schema> &schema);
+
+  ArrowIpcFileWriter(const ArrowIpcFileWriter &other) = delete;
+  ArrowIpcFileWriter(ArrowIpcFileWriter &&other) noexcept = default;
+  ~ArrowIpcFileWriter() noexcept;
+  ArrowIpcFileWriter &operator=(const ArrowIpcFileWriter &other) = delete;
+  ArrowIpcFileWriter &operator=(ArrowIpcFileWriter &&other) noexcept = default;
+
+  [[nodiscard]] std::int64_t rows_written() const noexcept;
+
+  void write(const arrow::Table &table);
+  // Write the file footer and close the underlying file. Files that are not closed explicitly are
+  // closed when the writer goes out of scope, but errors are then silently ignored
+  void close();
+};
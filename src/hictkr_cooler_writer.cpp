@@ -0,0 +1,398 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "./hictkr_cooler_writer.h"
+
+#include <Rcpp.h>
+#include <arrow/array.h>
+#include <arrow/record_batch.h>
+#include <arrow/type.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <hictk/bin_table.hpp>
+#include <hictk/cooler/cooler.hpp>
+#include <hictk/cooler/utils.hpp>
+#include <hictk/pixel.hpp>
+#include <hictk/reference.hpp>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./hictkr_arrow.h"
+
+[[nodiscard]] static hictk::Reference make_reference(const Rcpp::DataFrame &chromosomes) {
+  if (!chromosomes.containsElementNamed("name") || !chromosomes.containsElementNamed("size")) {
+    throw std::invalid_argument("chromosomes should be a data.frame with columns name and size");
+  }
+
+  const auto names = Rcpp::as<std::vector<std::string>>(chromosomes["name"]);
+  const auto sizes = Rcpp::as<std::vector<double>>(chromosomes["size"]);
+  std::vector<std::uint32_t> sizes_u32(sizes.size());
+  for (std::size_t i = 0; i < sizes.size(); ++i) {
+    if (!(sizes[i] > 0) || sizes[i] > std::numeric_limits<std::uint32_t>::max()) {
+      throw std::invalid_argument(
+          fmt::format(FMT_STRING("invalid size for chromosome {}: {}"), names[i], sizes[i]));
+    }
+    sizes_u32[i] = static_cast<std::uint32_t>(sizes[i]);
+  }
+
+  return {names.begin(), names.end(), sizes_u32.begin()};
+}
+
+CoolerWriter::CoolerWriter(std::string path, Rcpp::DataFrame chromosomes,
+                           std::int64_t resolution, std::string count_type,
+                           std::int64_t chunk_size, int compression_lvl, bool force)
+    : _path(std::move(path)),
+      _int_counts(count_type == "int"),
+      _force(force),
+      _tmpdir(Rcpp::as<std::string>(Rcpp::Function("tempdir")())) {
+  if (count_type != "int" && count_type != "float") {
+    throw std::invalid_argument("count_type should be either \"int\" or \"float\"");
+  }
+  if (resolution <= 0 || resolution > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::invalid_argument("resolution should be a positive integer");
+  }
+  if (chunk_size <= 0) {
+    throw std::invalid_argument("chunk_size should be a positive number");
+  }
+  if (compression_lvl < 0 || compression_lvl > 9) {
+    throw std::invalid_argument("compression_lvl should be between 0 and 9");
+  }
+  if (!force && std::filesystem::exists(_path)) {
+    throw std::runtime_error(fmt::format(
+        FMT_STRING("unable to create file \"{}\": file already exists. Pass force=TRUE to "
+                   "overwrite existing files"),
+        _path));
+  }
+  _bins = std::make_shared<const hictk::BinTable>(make_reference(chromosomes),
+                                                  static_cast<std::uint32_t>(resolution));
+  _chunk_size = static_cast<std::size_t>(chunk_size);
+  _compression_lvl = static_cast<std::uint32_t>(compression_lvl);
+  _buffer.reserve(std::min(_chunk_size, std::size_t{1'000'000}));
+}
+
+CoolerWriter::~CoolerWriter() noexcept { remove_chunks(); }
+
+std::string CoolerWriter::path() const { return _path; }
+std::uint32_t CoolerWriter::resolution() const noexcept { return _bins->resolution(); }
+std::uint64_t CoolerWriter::chunk_size() const noexcept { return _chunk_size; }
+std::uint64_t CoolerWriter::pixels_added() const noexcept { return _pixels_added; }
+std::uint64_t CoolerWriter::chunks_written() const noexcept { return _chunks.size(); }
+bool CoolerWriter::finalized() const noexcept { return _finalized; }
+
+void CoolerWriter::add_pixels(Rcpp::RObject pixels) {
+  if (_finalized) {
+    throw std::runtime_error("unable to add pixels: writer has already been finalized");
+  }
+
+  if (Rf_inherits(pixels, "nanoarrow_array_stream")) {
+    // Batches are processed one at a time, so that streams never need to fit in memory
+    const auto reader = import_arrow_array_stream(pixels);
+    while (true) {
+      auto batch = reader->Next();
+      if (!batch.ok()) {
+        throw std::runtime_error(fmt::format(
+            FMT_STRING("failed to read record batch: {}"), batch.status().message()));
+      }
+      if (!*batch) {
+        return;
+      }
+      add_record_batch(**batch);
+    }
+  }
+
+  if (!Rf_inherits(pixels, "data.frame")) {
+    throw std::invalid_argument("pixels should be a data.frame or a nanoarrow_array_stream");
+  }
+  add_df(Rcpp::DataFrame(pixels));
+}
+
+[[nodiscard]] static Rcpp::CharacterVector get_chrom_column(const Rcpp::DataFrame &df,
+                                                            const char *name) {
+  SEXP col = df[name];
+  if (Rf_isFactor(col)) {
+    return Rf_asCharacterFactor(col);
+  }
+  return Rcpp::as<Rcpp::CharacterVector>(col);
+}
+
+void CoolerWriter::add_df(const Rcpp::DataFrame &df) {
+  if (!df.containsElementNamed("count")) {
+    throw std::invalid_argument("pixels should have a count column");
+  }
+  const Rcpp::NumericVector counts = df["count"];
+
+  if (df.containsElementNamed("bin1_id") && df.containsElementNamed("bin2_id")) {
+    const Rcpp::NumericVector bin1_ids = df["bin1_id"];
+    const Rcpp::NumericVector bin2_ids = df["bin2_id"];
+    for (R_xlen_t i = 0; i < counts.size(); ++i) {
+      add_pixel(bin1_ids[i], bin2_ids[i], counts[i]);
+    }
+    return;
+  }
+
+  if (!df.containsElementNamed("chrom1") || !df.containsElementNamed("start1") ||
+      !df.containsElementNamed("chrom2") || !df.containsElementNamed("start2")) {
+    throw std::invalid_argument(
+        "pixels should be in COO (bin1_id, bin2_id, count) or bedgraph2 (chrom1, start1, end1, "
+        "chrom2, start2, end2, count) format");
+  }
+
+  const auto chroms1 = get_chrom_column(df, "chrom1");
+  const auto chroms2 = get_chrom_column(df, "chrom2");
+  const Rcpp::NumericVector starts1 = df["start1"];
+  const Rcpp::NumericVector starts2 = df["start2"];
+
+  for (R_xlen_t i = 0; i < counts.size(); ++i) {
+    add_pixel(bin_id(Rcpp::String{chroms1[i]}.get_cstring(), starts1[i]),
+              bin_id(Rcpp::String{chroms2[i]}.get_cstring(), starts2[i]), counts[i]);
+  }
+}
+
+// Return the value of element i of the given numeric array as a double. Nulls are returned as NaN
+[[nodiscard]] static double get_numeric_value(const arrow::Array &array, std::int64_t i) {
+  if (array.IsNull(i)) {
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+  switch (array.type_id()) {
+    case arrow::Type::INT8:
+      return static_cast<double>(static_cast<const arrow::Int8Array &>(array).Value(i));
+    case arrow::Type::UINT8:
+      return static_cast<double>(static_cast<const arrow::UInt8Array &>(array).Value(i));
+    case arrow::Type::INT16:
+      return static_cast<double>(static_cast<const arrow::Int16Array &>(array).Value(i));
+    case arrow::Type::UINT16:
+      return static_cast<double>(static_cast<const arrow::UInt16Array &>(array).Value(i));
+    case arrow::Type::INT32:
+      return static_cast<double>(static_cast<const arrow::Int32Array &>(array).Value(i));
+    case arrow::Type::UINT32:
+      return static_cast<double>(static_cast<const arrow::UInt32Array &>(array).Value(i));
+    case arrow::Type::INT64:
+      return static_cast<double>(static_cast<const arrow::Int64Array &>(array).Value(i));
+    case arrow::Type::UINT64:
+      return static_cast<double>(static_cast<const arrow::UInt64Array &>(array).Value(i));
+    case arrow::Type::FLOAT:
+      return static_cast<double>(static_cast<const arrow::FloatArray &>(array).Value(i));
+    case arrow::Type::DOUBLE:
+      return static_cast<const arrow::DoubleArray &>(array).Value(i);
+    default:
+      throw std::invalid_argument(fmt::format(
+          FMT_STRING("unsupported column type \"{}\": expected a numeric column"),
+          array.type()->ToString()));
+  }
+}
+
+// Return the value of element i of the given string or dictionary-encoded string array
+[[nodiscard]] static std::string_view get_string_value(const arrow::Array &array,
+                                                       std::int64_t i) {
+  if (array.IsNull(i)) {
+    throw std::invalid_argument("chromosome names cannot be null");
+  }
+  switch (array.type_id()) {
+    case arrow::Type::STRING:
+      return static_cast<const arrow::StringArray &>(array).GetView(i);
+    case arrow::Type::LARGE_STRING:
+      return static_cast<const arrow::LargeStringArray &>(array).GetView(i);
+    case arrow::Type::DICTIONARY: {
+      const auto &dict_array = static_cast<const arrow::DictionaryArray &>(array);
+      return get_string_value(*dict_array.dictionary(), dict_array.GetValueIndex(i));
+    }
+    default:
+      throw std::invalid_argument(fmt::format(
+          FMT_STRING("unsupported column type \"{}\": expected a string column"),
+          array.type()->ToString()));
+  }
+}
+
+void CoolerWriter::add_record_batch(const arrow::RecordBatch &batch) {
+  const auto counts = batch.GetColumnByName("count");
+  if (!counts) {
+    throw std::invalid_argument("pixels should have a count column");
+  }
+
+  const auto bin1_ids = batch.GetColumnByName("bin1_id");
+  const auto bin2_ids = batch.GetColumnByName("bin2_id");
+  if (bin1_ids && bin2_ids) {
+    for (std::int64_t i = 0; i < batch.num_rows(); ++i) {
+      add_pixel(get_numeric_value(*bin1_ids, i), get_numeric_value(*bin2_ids, i),
+                get_numeric_value(*counts, i));
+    }
+    return;
+  }
+
+  const auto chroms1 = batch.GetColumnByName("chrom1");
+  const auto starts1 = batch.GetColumnByName("start1");
+  const auto chroms2 = batch.GetColumnByName("chrom2");
+  const auto starts2 = batch.GetColumnByName("start2");
+  if (!chroms1 || !starts1 || !chroms2 || !starts2) {
+    throw std::invalid_argument(
+        "pixels should be in COO (bin1_id, bin2_id, count) or bedgraph2 (chrom1, start1, end1, "
+        "chrom2, start2, end2, count) format");
+  }
+
+  for (std::int64_t i = 0; i < batch.num_rows(); ++i) {
+    add_pixel(bin_id(get_string_value(*chroms1, i), get_numeric_value(*starts1, i)),
+              bin_id(get_string_value(*chroms2, i), get_numeric_value(*starts2, i)),
+              get_numeric_value(*counts, i));
+  }
+}
+
+double CoolerWriter::bin_id(std::string_view chrom_name, double pos) const {
+  const auto &chrom = _bins->chromosomes().at(chrom_name);
+  if (!(pos >= 0) || pos >= chrom.size()) {
+    throw std::invalid_argument(fmt::format(FMT_STRING("position {} is outside of chromosome {}"),
+                                            pos, chrom.name()));
+  }
+  return static_cast<double>(_bins->at(chrom, static_cast<std::uint32_t>(pos)).id());
+}
+
+void CoolerWriter::add_pixel(double bin1_id, double bin2_id, double count) {
+  const auto num_bins = static_cast<double>(_bins->size());
+  if (!(bin1_id >= 0) || !(bin2_id >= 0) || bin1_id >= num_bins || bin2_id >= num_bins ||
+      bin1_id != std::floor(bin1_id) || bin2_id != std::floor(bin2_id)) {
+    throw std::invalid_argument(
+        fmt::format(FMT_STRING("invalid pixel {}:{}: bin IDs should be integers between 0 and {}"),
+                    bin1_id, bin2_id, _bins->size() - 1));
+  }
+  if (!std::isfinite(count)) {
+    throw std::invalid_argument(
+        fmt::format(FMT_STRING("invalid pixel {}:{}: count should be a finite number"), bin1_id,
+                    bin2_id));
+  }
+
+  // Coolers only store the upper triangle of the matrix
+  if (bin1_id > bin2_id) {
+    std::swap(bin1_id, bin2_id);
+  }
+  _buffer.push_back(hictk::ThinPixel<double>{static_cast<std::uint64_t>(bin1_id),
+                                             static_cast<std::uint64_t>(bin2_id), count});
+  ++_pixels_added;
+
+  if (_buffer.size() >= _chunk_size) {
+    spill();
+  }
+}
+
+void CoolerWriter::spill() {
+  if (_buffer.empty()) {
+    return;
+  }
+
+  std::sort(_buffer.begin(), _buffer.end(), [](const auto &p1, const auto &p2) {
+    return std::make_pair(p1.bin1_id, p1.bin2_id) < std::make_pair(p2.bin1_id, p2.bin2_id);
+  });
+
+  // Sum the counts of pixels with the same coordinates
+  auto last = _buffer.begin();
+  for (auto it = _buffer.begin() + 1; it != _buffer.end(); ++it) {
+    if (it->bin1_id == last->bin1_id && it->bin2_id == last->bin2_id) {
+      last->count += it->count;
+    } else {
+      *++last = *it;
+    }
+  }
+  _buffer.erase(last + 1, _buffer.end());
+
+  const auto uri =
+      (_tmpdir / fmt::format(FMT_STRING("{}.{}.chunk_{:04d}.cool"),
+                             std::filesystem::path{_path}.filename().string(),
+                             fmt::ptr(this), _chunks.size()))
+          .string();
+  _chunks.push_back(uri);
+  if (_int_counts) {
+    write_chunk<std::int32_t>(uri);
+  } else {
+    write_chunk<double>(uri);
+  }
+  _buffer.clear();
+}
+
+template <typename N>
+void CoolerWriter::write_chunk(const std::string &uri) {
+  std::vector<hictk::ThinPixel<N>> pixels(_buffer.size());
+  std::transform(_buffer.begin(), _buffer.end(), pixels.begin(), [](const auto &p) {
+    if constexpr (std::is_integral_v<N>) {
+      if (p.count > std::numeric_limits<N>::max() || p.count < std::numeric_limits<N>::min()) {
+        throw std::overflow_error(
+            fmt::format(FMT_STRING("aggregated count for pixel {}:{} does not fit in a 32-bit "
+                                   "integer: please use count_type=\"float\""),
+                        p.bin1_id, p.bin2_id));
+      }
+    }
+    return hictk::ThinPixel<N>{p.bin1_id, p.bin2_id, static_cast<N>(p.count)};
+  });
+
+  // Temporary files are only read once by merge_chunks(): favor speed over compression ratio
+  constexpr std::uint32_t tmp_compression_lvl = 1;
+  auto clr = hictk::cooler::File::create<N>(
+      uri, _bins->chromosomes(), _bins->resolution(), true,
+      hictk::cooler::Attributes::init<N>(_bins->resolution()),
+      hictk::cooler::DEFAULT_HDF5_CACHE_SIZE, tmp_compression_lvl);
+  clr.append_pixels(pixels.begin(), pixels.end());
+}
+
+template <typename N>
+void CoolerWriter::merge_chunks() const {
+  if (_chunks.empty()) {
+    static_cast<void>(hictk::cooler::File::create<N>(
+        _path, _bins->chromosomes(), _bins->resolution(), _force,
+        hictk::cooler::Attributes::init<N>(_bins->resolution()),
+        hictk::cooler::DEFAULT_HDF5_CACHE_SIZE, _compression_lvl));
+    return;
+  }
+
+  // Pixels with the same coordinates found in different chunks are summed while merging
+  hictk::cooler::utils::merge<N>(_chunks.begin(), _chunks.end(), _path, _force, _chunk_size,
+                                 std::numeric_limits<std::size_t>::max(), _compression_lvl);
+}
+
+std::string CoolerWriter::finalize() {
+  if (_finalized) {
+    throw std::runtime_error("writer has already been finalized");
+  }
+
+  spill();
+  if (_int_counts) {
+    merge_chunks<std::int32_t>();
+  } else {
+    merge_chunks<double>();
+  }
+  remove_chunks();
+  _finalized = true;
+  return _path;
+}
+
+void CoolerWriter::remove_chunks() noexcept {
+  for (const auto &uri : _chunks) {
+    std::error_code ec{};
+    std::filesystem::remove(uri, ec);
+  }
+  _chunks.clear();
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <Rcpp.h>
+#include <arrow/type_fwd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <hictk/bin_table.hpp>
+#include <hictk/pixel.hpp>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Write interactions to a new .cool file.
+// Pixels can be added in any order and in chunks of any size: pixels are buffered in memory and,
+// once the buffer is full, sorted, aggregated, and spilled to a temporary .cool file. Temporary
+// files are merged into the output file by finalize(), so that memory usage is bounded by the
+// size of the buffer regardless of the number of interactions being written.
+// Temporary files are created in the temporary directory of the R session.
+class CoolerWriter {
+  std::string _path{};
+  std::shared_ptr<const hictk::BinTable> _bins{};
+  bool _int_counts{};
+  std::size_t _chunk_size{};
+  std::uint32_t _compression_lvl{};
+  bool _force{};
+  std::filesystem::path _tmpdir{};
+  std::vector<hictk::ThinPixel<double>> _buffer{};
+  std::vector<std::string> _chunks{};
+  std::uint64_t _pixels_added{};
+  bool _finalized{};
+
+ public:
+  CoolerWriter(std::string path, Rcpp::DataFrame chromosomes, std::int64_t resolution,
+               std::string count_type, std::int64_t chunk_size, int compression_lvl, bool force);
+
+  CoolerWriter(const CoolerWriter &other) = delete;
+  CoolerWriter(CoolerWriter &&other) noexcept = delete;
+  ~CoolerWriter() noexcept;
+  CoolerWriter &operator=(const CoolerWriter &other) = delete;
+  CoolerWriter &operator=(CoolerWriter &&other) noexcept = delete;
+
+  [[nodiscard]] std::string path() const;
+  [[nodiscard]] std::uint32_t resolution() const noexcept;
+  [[nodiscard]] std::uint64_t chunk_size() const noexcept;
+  [[nodiscard]] std::uint64_t pixels_added() const noexcept;
+  [[nodiscard]] std::uint64_t chunks_written() const noexcept;
+  [[nodiscard]] bool finalized() const noexcept;
+
+  // Add the pixels from a data.frame in COO or bedgraph2 format (such as those returned by fetch())
+  // or from a nanoarrow_array_stream yielding batches in one of these formats
+  void add_pixels(Rcpp::RObject pixels);
+
+  // Write all pixels added so far to the output file and return its path.
+  // No pixels can be added once the writer has been finalized
+  std::string finalize();
+
+ private:
+  void add_df(const Rcpp::DataFrame &df);
+  // Read pixels straight from the Arrow arrays of the given batch, without going through R
+  void add_record_batch(const arrow::RecordBatch &batch);
+  void add_pixel(double bin1_id, double bin2_id, double count);
+  [[nodiscard]] double bin_id(std::string_view chrom_name, double pos) const;
+  // Sort and aggregate the pixels in the buffer, then write them to a temporary file
+  void spill();
+  template <typename N>
+  void write_chunk(const std::string &uri);
+  template <typename N>
+  void merge_chunks() const;
+  void remove_chunks() noexcept;
+};
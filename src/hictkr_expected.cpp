@@ -0,0 +1,191 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#include "./hictkr_expected.h"
+
+#include <Rcpp.h>
+#include <fmt/format.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/balancing/weights.hpp>
+#include <hictk/bin_table.hpp>
+#include <hictk/file.hpp>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+ExpectedValues::ExpectedValues(const hictk::File &f, const hictk::balancing::Method &normalization)
+    : _bins(std::visit([](const auto &ff) { return ff.bins_ptr(); }, f.get())) {
+  if (_bins->resolution() == 0) {
+    throw std::invalid_argument(
+        "expected values can only be computed for files with a fixed bin size");
+  }
+
+  const auto nchroms = _bins->chromosomes().size();
+  _cis_sums.resize(nchroms);
+  for (const auto &chrom : _bins->chromosomes()) {
+    if (!chrom.is_all()) {
+      _cis_sums[chrom.id()].resize(num_bins(chrom.id()), 0.0);
+    }
+  }
+  _trans_sums.resize(nchroms * nchroms, 0.0);
+  count_valid_pixels(f, normalization);
+
+  std::visit(
+      [&](const auto &ff) {
+        const auto sel = ff.fetch(normalization);
+        const auto last = sel.template end<double>();
+        for (auto it = sel.template begin<double>(); it != last; ++it) {
+          const auto &p = *it;
+          // Interactions involving bins masked by the normalization are NaN
+          if (!std::isfinite(p.count)) {
+            continue;
+          }
+          const auto chrom1 = chrom_id(p.bin1_id);
+          const auto chrom2 = chrom_id(p.bin2_id);
+          if (chrom1 == chrom2) {
+            _cis_sums[chrom1][p.bin2_id - p.bin1_id] += p.count;
+          } else {
+            _trans_sums[(chrom1 * nchroms) + chrom2] += p.count;
+          }
+        }
+      },
+      f.get());
+}
+
+// Count the number of pixels on each diagonal of the cis matrices that do not involve bins masked
+// by the normalization.
+// The number of valid pixels on diagonal d is computed as (n - d) minus the number of pixels whose
+// row or column is masked, plus the number of pixels whose row and column are both masked: this
+// only requires looping over pairs of masked bins, which are usually few
+void ExpectedValues::count_valid_pixels(const hictk::File &f,
+                                        const hictk::balancing::Method &normalization) {
+  const auto nchroms = _bins->chromosomes().size();
+  _cis_num_pixels.resize(nchroms);
+  _num_valid_bins.resize(nchroms, 0);
+
+  std::vector<double> weights{};
+  if (normalization != hictk::balancing::Method::NONE()) {
+    weights = f.normalization(normalization.to_string())(
+        hictk::balancing::Weights::Type::MULTIPLICATIVE);
+    if (weights.size() != _bins->size()) {
+      throw std::runtime_error(fmt::format(
+          FMT_STRING("\"{}\" weights have {} values, expected {}"), normalization.to_string(),
+          weights.size(), _bins->size()));
+    }
+  }
+
+  std::uint64_t offset = 0;
+  for (const auto &chrom : _bins->chromosomes()) {
+    if (chrom.is_all()) {
+      continue;
+    }
+    const auto n = num_bins(chrom.id());
+
+    // masked_prefix[i] is the number of masked bins in [0, i)
+    std::vector<std::uint64_t> masked_prefix(n + 1, 0);
+    std::vector<std::uint64_t> masked{};
+    for (std::uint64_t i = 0; i < n; ++i) {
+      const auto is_masked = !weights.empty() && !std::isfinite(weights[offset + i]);
+      if (is_masked) {
+        masked.push_back(i);
+      }
+      masked_prefix[i + 1] = masked_prefix[i] + static_cast<std::uint64_t>(is_masked);
+    }
+
+    std::vector<std::uint64_t> both_masked(n, 0);
+    for (std::size_t i = 0; i < masked.size(); ++i) {
+      for (std::size_t j = i; j < masked.size(); ++j) {
+        ++both_masked[masked[j] - masked[i]];
+      }
+    }
+
+    auto &num_pixels = _cis_num_pixels[chrom.id()];
+    num_pixels.resize(n);
+    for (std::uint64_t d = 0; d < n; ++d) {
+      const auto masked_rows = masked_prefix[n - d];
+      const auto masked_cols = masked_prefix[n] - masked_prefix[d];
+      num_pixels[d] = static_cast<double>((n - d) + both_masked[d] - masked_rows - masked_cols);
+    }
+
+    _num_valid_bins[chrom.id()] = n - masked.size();
+    offset += n;
+  }
+}
+
+std::uint32_t ExpectedValues::chrom_id(std::uint64_t bin_id) const {
+  return _bins->at(bin_id).chrom().id();
+}
+
+std::uint64_t ExpectedValues::num_bins(std::uint32_t chrom_id) const {
+  const auto &chrom = _bins->chromosomes().at(chrom_id);
+  return (std::uint64_t{chrom.size()} + _bins->resolution() - 1) / _bins->resolution();
+}
+
+double ExpectedValues::at(std::uint64_t bin1_id, std::uint64_t bin2_id) const {
+  const auto chrom1 = chrom_id(bin1_id);
+  const auto chrom2 = chrom_id(bin2_id);
+  if (chrom1 == chrom2) {
+    const auto diag = bin1_id > bin2_id ? bin1_id - bin2_id : bin2_id - bin1_id;
+    return _cis_sums[chrom1][diag] / _cis_num_pixels[chrom1][diag];
+  }
+
+  const auto nchroms = _bins->chromosomes().size();
+  const auto sum = chrom1 < chrom2 ? _trans_sums[(chrom1 * nchroms) + chrom2]
+                                   : _trans_sums[(chrom2 * nchroms) + chrom1];
+  return sum / static_cast<double>(_num_valid_bins[chrom1] * _num_valid_bins[chrom2]);
+}
+
+Rcpp::DataFrame ExpectedValues::to_df() const {
+  std::size_t num_rows = 0;
+  for (const auto &sums : _cis_sums) {
+    num_rows += sums.size();
+  }
+
+  Rcpp::CharacterVector chrom(static_cast<R_xlen_t>(num_rows));
+  Rcpp::NumericVector diag(static_cast<R_xlen_t>(num_rows));
+  Rcpp::NumericVector num_pixels(static_cast<R_xlen_t>(num_rows));
+  Rcpp::NumericVector sum(static_cast<R_xlen_t>(num_rows));
+  Rcpp::NumericVector expected(static_cast<R_xlen_t>(num_rows));
+
+  R_xlen_t i = 0;
+  for (const auto &c : _bins->chromosomes()) {
+    if (c.is_all()) {
+      continue;
+    }
+    const auto &sums = _cis_sums[c.id()];
+    const auto &counts = _cis_num_pixels[c.id()];
+    const auto name = std::string{c.name()};
+    for (std::size_t d = 0; d < sums.size(); ++d, ++i) {
+      chrom[i] = name;
+      diag[i] = static_cast<double>(d);
+      num_pixels[i] = counts[d];
+      sum[i] = sums[d];
+      expected[i] = sums[d] / counts[d];
+    }
+  }
+
+  return Rcpp::DataFrame::create(Rcpp::Named("chrom") = chrom, Rcpp::Named("diag") = diag,
+                                 Rcpp::Named("num_pixels") = num_pixels,
+                                 Rcpp::Named("sum") = sum, Rcpp::Named("expected") = expected);
+}
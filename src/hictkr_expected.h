@@ -0,0 +1,125 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <Rcpp.h>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/bin_table.hpp>
+#include <hictk/file.hpp>
+#include <hictk/pixel.hpp>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Expected interactions computed with a single pass over the pixels of a file.
+// Expected values follow the definition used by .hic files: for cis matrices, the expected value
+// of a diagonal is the sum of the interactions on that diagonal divided by the number of pixels
+// on the diagonal; for trans matrices, it is the average interaction of the chromosome pair.
+// When a normalization is given, pixels involving bins masked by the normalization (i.e. bins
+// with NaN weights) are not counted, as done by cooltools.
+class ExpectedValues {
+  std::shared_ptr<const hictk::BinTable> _bins{};
+  // Indexed by chromosome id, then by diagonal
+  std::vector<std::vector<double>> _cis_sums{};
+  std::vector<std::vector<double>> _cis_num_pixels{};
+  // nchroms x nchroms matrix indexed by chromosome ids
+  std::vector<double> _trans_sums{};
+  // Number of bins not masked by the normalization, indexed by chromosome id
+  std::vector<std::uint64_t> _num_valid_bins{};
+
+ public:
+  ExpectedValues(const hictk::File &f, const hictk::balancing::Method &normalization);
+
+  [[nodiscard]] double at(std::uint64_t bin1_id, std::uint64_t bin2_id) const;
+
+  // Iterator replacing the interactions of the pixels from the underlying iterator with their
+  // observed/expected ratio or, when obs_over_exp is false, with their expected value.
+  // Pixels are transformed one at a time as the iterator is advanced
+  template <typename N, typename PixelIt>
+  class TransformIterator {
+    PixelIt _it{};
+    const ExpectedValues *_expected{};
+    bool _obs_over_exp{true};
+
+   public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = hictk::ThinPixel<N>;
+    using pointer = const value_type *;
+    using reference = value_type;
+    using iterator_category = std::input_iterator_tag;
+
+    TransformIterator() = default;
+    TransformIterator(PixelIt it, const ExpectedValues &expected, bool obs_over_exp)
+        : _it(std::move(it)), _expected(&expected), _obs_over_exp(obs_over_exp) {}
+
+    [[nodiscard]] value_type operator*() const {
+      const auto &p = *_it;
+      const auto expected = _expected->at(p.bin1_id, p.bin2_id);
+      const auto count = _obs_over_exp ? static_cast<double>(p.count) / expected : expected;
+      return {p.bin1_id, p.bin2_id, static_cast<N>(count)};
+    }
+
+    TransformIterator &operator++() {
+      ++_it;
+      return *this;
+    }
+
+    TransformIterator operator++(int) {
+      auto it = *this;
+      ++_it;
+      return it;
+    }
+
+    [[nodiscard]] bool operator==(const TransformIterator &other) const {
+      return _it == other._it;
+    }
+    [[nodiscard]] bool operator!=(const TransformIterator &other) const {
+      return !(*this == other);
+    }
+  };
+
+  // Return the pair of iterators used to lazily transform the pixels in the given range
+  template <typename N, typename PixelIt>
+  [[nodiscard]] std::pair<TransformIterator<N, PixelIt>, TransformIterator<N, PixelIt>> transform(
+      PixelIt first, PixelIt last, bool obs_over_exp) const {
+    return {TransformIterator<N, PixelIt>{std::move(first), *this, obs_over_exp},
+            TransformIterator<N, PixelIt>{std::move(last), *this, obs_over_exp}};
+  }
+
+  // Return a DataFrame with the expected value of each diagonal of the cis matrices
+  [[nodiscard]] Rcpp::DataFrame to_df() const;
+
+ private:
+  [[nodiscard]] std::uint32_t chrom_id(std::uint64_t bin_id) const;
+  [[nodiscard]] std::uint64_t num_bins(std::uint32_t chrom_id) const;
+  void count_valid_pixels(const hictk::File &f, const hictk::balancing::Method &normalization);
+};
+
+// Transformation used to compute oe and expected matrices from the pixels of Cooler files.
+// A default-constructed object leaves pixels untouched
+struct ExpectedTransform {
+  const ExpectedValues *expected{};
+  bool obs_over_exp{true};
+};
@@ -0,0 +1,91 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_fetch_future.h"
+
+#include <Rcpp.h>
+#include <arrow/table.h>
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "./hictkr_arrow.h"
+
+FetchFuture::FetchFuture(std::shared_future<FetchResult> future) : _future(std::move(future)) {
+  if (!_future.valid()) {
+    throw std::invalid_argument("FetchFuture: future should be valid");
+  }
+}
+
+bool FetchFuture::ready() const {
+  return _value.has_value() ||
+         _future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void FetchFuture::wait() const {
+  if (_value.has_value()) {
+    return;
+  }
+  while (_future.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+    Rcpp::checkUserInterrupt();
+  }
+}
+
+template <typename N>
+[[nodiscard]] static Rcpp::RObject to_r_matrix(const DenseMatrixBuffer<N> &buffer) {
+  constexpr auto max_size = static_cast<std::uint64_t>(std::numeric_limits<int>::max());
+  if (buffer.nrow > max_size || buffer.ncol > max_size) {
+    throw std::runtime_error("matrix dimensions cannot exceed INT_MAX");
+  }
+
+  using RcppMatrix =
+      std::conditional_t<std::is_same_v<N, double>, Rcpp::NumericMatrix, Rcpp::IntegerMatrix>;
+  RcppMatrix matrix(Rcpp::no_init(static_cast<int>(buffer.nrow), static_cast<int>(buffer.ncol)));
+  std::copy(buffer.data.begin(), buffer.data.end(), matrix.begin());
+  return matrix;
+}
+
+Rcpp::RObject FetchFuture::value() {
+  if (_value.has_value()) {
+    return *_value;
+  }
+
+  wait();
+  _value = std::visit(
+      [](const auto &res) -> Rcpp::RObject {
+        using T = std::decay_t<decltype(res)>;
+        if constexpr (std::is_same_v<T, std::shared_ptr<arrow::Table>>) {
+          return arrow_table_to_df(res);
+        } else {
+          return to_r_matrix(res);
+        }
+      },
+      _future.get());
+
+  // The result has been converted: release the memory used to store it
+  _future = {};
+
+  return *_value;
+}
@@ -0,0 +1,70 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+#include <arrow/table.h>
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <variant>
+#include <vector>
+
+// Dense matrix stored in column-major order in a buffer that is not managed by R
+template <typename N>
+struct DenseMatrixBuffer {
+  std::vector<N> data{};
+  std::uint64_t nrow{};
+  std::uint64_t ncol{};
+};
+
+// Result of a query carried out in the background. Results never store R objects, as they may be
+// produced by threads other than R's main thread
+using FetchResult = std::variant<std::shared_ptr<arrow::Table>, DenseMatrixBuffer<int>,
+                                 DenseMatrixBuffer<double>>;
+
+// Handle to the result of a query that is being processed in the background.
+// Only the conversion of the result to an R object takes place on R's main thread.
+// Destroying a handle blocks until the query it refers to has been processed.
+class FetchFuture {
+  // Shared futures can be queried multiple times: errors are thus re-thrown on each call to value()
+  std::shared_future<FetchResult> _future;
+  std::optional<Rcpp::RObject> _value{};
+
+ public:
+  explicit FetchFuture(std::shared_future<FetchResult> future);
+
+  FetchFuture(const FetchFuture &other) = delete;
+  FetchFuture(FetchFuture &&other) noexcept = delete;
+  ~FetchFuture() noexcept = default;
+  FetchFuture &operator=(const FetchFuture &other) = delete;
+  FetchFuture &operator=(FetchFuture &&other) noexcept = delete;
+
+  // Return whether the query has been processed (successfully or not)
+  [[nodiscard]] bool ready() const;
+  // Block until the query has been processed. Waiting can be interrupted from R
+  void wait() const;
+  // Wait for the query to be processed and return its result as a data.frame or matrix.
+  // Errors raised while processing the query are re-thrown by this function
+  [[nodiscard]] Rcpp::RObject value();
+};
+
+RCPP_EXPOSED_CLASS_NODECL(FetchFuture)
@@ -24,32 +24,53 @@
 #include "./RcppEigen/RcppEigen.h"
 // clang-format off
 
-#include <arrow/c/abi.h>
-#include <arrow/c/bridge.h>
 #include <arrow/table.h>
 #include <fmt/format.h>
 
+#include <BS_thread_pool.hpp>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cmath>
 #include <cstdint>
+#include <filesystem>
+#include <future>
+#include <hictk/balancing/ice.hpp>
 #include <hictk/balancing/methods.hpp>
+#include <hictk/balancing/scale.hpp>
+#include <hictk/balancing/vc.hpp>
+#include <hictk/balancing/weights.hpp>
 #include <hictk/bin_table.hpp>
+#include <hictk/chromosome.hpp>
 #include <hictk/cooler/cooler.hpp>
 #include <hictk/genomic_interval.hpp>
 #include <hictk/hic.hpp>
+#include <hictk/hic/validation.hpp>
+#include <hictk/pixel.hpp>
+#include <hictk/reference.hpp>
+#include <hictk/transformers/coarsen.hpp>
 #include <hictk/transformers/join_genomic_coords.hpp>
 #include <hictk/transformers/to_dataframe.hpp>
-#include <hictk/transformers/to_dense_matrix.hpp>
+#include <iterator>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <stdexcept>
 #include <string>
+#include <system_error>
+#include <tuple>
 #include <utility>
 #include <variant>
 #include <vector>
 
 #include "./common.h"
+#include "./hictkr_arrow.h"
+#include "./hictkr_expected.h"
+#include "./hictkr_fetch_future.h"
+#include "./hictkr_handle_pool.h"
+#include "./hictkr_profiler.h"
 
 [[nodiscard]] static std::optional<std::uint32_t> get_resolution_checked(
     std::optional<std::int64_t> resolution) {
@@ -70,10 +91,24 @@
   return static_cast<std::uint32_t>(*resolution);
 }
 
+// oe and expected matrices are computed by hictk when reading .hic files, and by ExpectedValues
+// when reading Cooler files: Cooler files are thus always opened as observed matrices
+[[nodiscard]] static hictk::hic::MatrixType get_reader_matrix_type(
+    const std::string &uri, hictk::hic::MatrixType matrix_type) {
+  if (hictk::hic::utils::is_hic_file(uri)) {
+    return matrix_type;
+  }
+  return hictk::hic::MatrixType::observed;
+}
+
 HiCFile::HiCFile(std::string uri, std::optional<std::int64_t> resolution_, std::string matrix_type,
                  std::string matrix_unit)
-    : _fp(uri, get_resolution_checked(resolution_), hictk::hic::ParseMatrixTypeStr(matrix_type),
-          hictk::hic::ParseUnitStr(matrix_unit)) {}
+    : _fp(FileHandlePool::instance().open(
+          uri, get_resolution_checked(resolution_),
+          get_reader_matrix_type(uri, hictk::hic::ParseMatrixTypeStr(matrix_type)),
+          hictk::hic::ParseUnitStr(matrix_unit))),
+      _matrix_type(hictk::hic::ParseMatrixTypeStr(matrix_type)),
+      _matrix_unit(hictk::hic::ParseUnitStr(matrix_unit)) {}
 
 HiCFile::HiCFile(std::string uri, std::string matrix_type, std::string matrix_unit)
     : HiCFile(std::move(uri), std::nullopt, std::move(matrix_type), std::move(matrix_unit)) {}
@@ -83,20 +118,50 @@ HiCFile::HiCFile(std::string uri, std::int64_t resolution_, std::string matrix_t
     : HiCFile(std::move(uri), std::make_optional(resolution_), std::move(matrix_type),
               std::move(matrix_unit)) {}
 
-HiCFile::HiCFile(hictk::cooler::File &&clr) : _fp(std::move(clr)) {}
-HiCFile::HiCFile(hictk::hic::File &&hf) : _fp(std::move(hf)) {}
+HiCFile::HiCFile(hictk::cooler::File &&clr)
+    : _fp(std::make_shared<const hictk::File>(std::move(clr))) {}
+HiCFile::HiCFile(hictk::hic::File &&hf) : _fp(std::make_shared<const hictk::File>(std::move(hf))) {}
 
-bool HiCFile::is_cooler() const noexcept { return _fp.is_cooler(); }
-bool HiCFile::is_hic() const noexcept { return _fp.is_hic(); }
+hictk::File HiCFile::open_handle() const {
+  if (is_cooler()) {
+    return hictk::File{_fp->uri()};
+  }
+  return hictk::File{std::string{_fp->path()}, _fp->resolution(), _matrix_type, _matrix_unit};
+}
 
-Rcpp::DataFrame HiCFile::chromosomes() const { return get_chromosomes(_fp); }
+std::shared_ptr<const ExpectedValues> HiCFile::get_expected_values(
+    const hictk::balancing::Method &normalization) const {
+  auto [it, inserted] = _expected_values.try_emplace(normalization.to_string());
+  if (inserted) {
+    try {
+      it->second = std::make_shared<const ExpectedValues>(*_fp, normalization);
+    } catch (...) {
+      _expected_values.erase(it);
+      throw;
+    }
+  }
+  return it->second;
+}
+
+bool HiCFile::is_cooler() const noexcept { return _fp->is_cooler(); }
+bool HiCFile::is_hic() const noexcept { return _fp->is_hic(); }
 
-Rcpp::DataFrame HiCFile::bins() const { return get_bins(_fp); }
+Rcpp::DataFrame HiCFile::chromosomes() const { return get_chromosomes(*_fp); }
 
-std::string HiCFile::path() const noexcept { return {_fp.path()}; }
-std::uint32_t HiCFile::resolution() const noexcept { return _fp.resolution(); }
-std::uint64_t HiCFile::nbins() const noexcept { return _fp.nbins(); }
-std::uint64_t HiCFile::nchroms() const noexcept { return _fp.nchroms(); }
+Rcpp::DataFrame HiCFile::bins() const {
+  if (!_bins.has_value()) {
+    _bins = get_bins(*_fp);
+    mark_not_mutable(*_bins);
+  }
+  // Return a shallow copy so that changes to the attributes of the returned data.frame
+  // (e.g. its names) do not affect the cached bin table
+  return Rcpp::DataFrame{Rf_shallow_duplicate(*_bins)};
+}
+
+std::string HiCFile::path() const noexcept { return {_fp->path()}; }
+std::uint32_t HiCFile::resolution() const noexcept { return _fp->resolution(); }
+std::uint64_t HiCFile::nbins() const noexcept { return _fp->nbins(); }
+std::uint64_t HiCFile::nchroms() const noexcept { return _fp->nchroms(); }
 
 [[nodiscard]] static Rcpp::List get_cooler_attrs(const hictk::cooler::File &clr) {
   Rcpp::List r_attrs{};
@@ -194,9 +259,9 @@ Rcpp::List HiCFile::attributes() const {
 
   std::vector<std::string> attr_names;
   if (is_cooler()) {
-    return get_cooler_attrs(_fp.get<hictk::cooler::File>());
+    return get_cooler_attrs(_fp->get<hictk::cooler::File>());
   }
-  return get_hic_attrs(_fp.get<hictk::hic::File>());
+  return get_hic_attrs(_fp->get<hictk::hic::File>());
 }
 
 template <typename N, typename PixelSelector>
@@ -225,204 +290,1792 @@ template <typename N, typename PixelSelector>
   }
 }
 
-static void arrow_schema_deleter(ArrowSchema *schema) noexcept {
-  try {
-    if (schema->release) {
-      schema->release(schema);
-    }
-    free(schema);
-  } catch (...) {  // NOLINT
+template <typename N, typename PixelSelector>
+[[nodiscard]] static std::shared_ptr<arrow::Table> make_arrow_df(
+    const PixelSelector &sel, bool join,
+    hictk::transformers::QuerySpan span = hictk::transformers::QuerySpan::upper_triangle,
+    std::optional<std::uint64_t> diagonal_band_width = {}) {
+  if (join) {
+    return make_bg2_arrow_df<N>(sel, span, diagonal_band_width);
   }
+  return make_coo_arrow_df<N>(sel, span, diagonal_band_width);
 }
 
-static void arrow_array_stream_deleter(ArrowArrayStream *stream) noexcept {
-  try {
-    if (stream->release) {
-      stream->release(stream);
-    }
-    free(stream);
-  } catch (...) {  // NOLINT
+[[nodiscard]] static hictk::balancing::Method to_hictk_normalization_method(
+    const Rcpp::Nullable<Rcpp::String> &name) {
+  if (name.isNull() || Rcpp::as<Rcpp::String>(name) == "NONE") {
+    return hictk::balancing::Method::NONE();
   }
+  return hictk::balancing::Method{Rcpp::as<std::string>(name)};
 }
 
-using ArrowSchemaXPtr = Rcpp::XPtr<ArrowSchema, Rcpp::PreserveStorage, arrow_schema_deleter>;
-using ArrowArrayStreamXPtr =
-    Rcpp::XPtr<ArrowArrayStream, Rcpp::PreserveStorage, arrow_array_stream_deleter>;
+[[nodiscard]] static std::optional<std::string> to_optional_string(
+    const Rcpp::Nullable<Rcpp::String> &s) {
+  if (s.isNull()) {
+    return {};
+  }
+  return Rcpp::as<std::string>(s);
+}
 
-[[nodiscard]] static ArrowSchemaXPtr export_arrow_schema(
-    const std::shared_ptr<arrow::Schema> &schema_in) {
-  auto *schema = static_cast<ArrowSchema *>(malloc(sizeof(ArrowSchema)));
-  if (!schema) {
-    throw std::bad_alloc();
+[[nodiscard]] static hictk::GenomicInterval::Type parse_query_type(const std::string &query_type) {
+  return query_type == "UCSC" ? hictk::GenomicInterval::Type::UCSC
+                              : hictk::GenomicInterval::Type::BED;
+}
+
+// Call fn with a value of the type used to fetch interactions of the given count_type
+template <typename Fn>
+[[nodiscard]] static auto visit_count_type(const std::string &count_type, Fn &&fn) {
+  if (count_type == "int") {
+    return fn(std::int32_t{});
+  }
+  if (count_type == "float32") {
+    return fn(float{});
   }
+  return fn(double{});
+}
 
-  const auto status = arrow::ExportSchema(*schema_in, schema);
-  if (!status.ok()) {
-    free(schema);
-    throw std::runtime_error(fmt::format(
-        FMT_STRING("Failed to export arrow::Schema as ArrowSchema: {}"), status.message()));
+[[nodiscard]] static hictk::transformers::QuerySpan parse_query_span(const std::string &span) {
+  if (span == "upper_triangle") {
+    return hictk::transformers::QuerySpan::upper_triangle;
+  }
+  if (span == "lower_triangle") {
+    return hictk::transformers::QuerySpan::lower_triangle;
+  }
+  if (span == "full") {
+    return hictk::transformers::QuerySpan::full;
+  }
+  throw std::invalid_argument(
+      "span should be one of \"upper_triangle\", \"lower_triangle\", or \"full\"");
+}
+
+[[nodiscard]] static std::optional<std::uint64_t> to_optional_band_width(
+    const Rcpp::Nullable<Rcpp::NumericVector> &diagonal_band_width) {
+  if (diagonal_band_width.isNull()) {
+    return {};
   }
 
-  ArrowSchemaXPtr ptr{schema, true};
-  ptr.attr("class") = "nanoarrow_schema";
-  return ptr;
+  const auto width = Rcpp::as<double>(diagonal_band_width.get());
+  if (!(width > 0)) {
+    throw std::invalid_argument("diagonal_band_width should be a positive number");
+  }
+  return static_cast<std::uint64_t>(width);
 }
 
-[[nodiscard]] static ArrowArrayStreamXPtr export_arrow_array_stream(
-    std::shared_ptr<arrow::ChunkedArray> column, const ArrowSchemaXPtr &schema) {
-  auto *array_stream = static_cast<ArrowArrayStream *>(malloc(sizeof(ArrowArrayStream)));
-  if (!array_stream) {
-    throw std::bad_alloc();
+namespace {
+struct BinRange {
+  std::uint64_t offset{};
+  std::uint64_t size{};
+
+  [[nodiscard]] bool contains(std::uint64_t bin_id) const noexcept {
+    return bin_id >= offset && bin_id - offset < size;
+  }
+  [[nodiscard]] bool operator==(const BinRange &other) const noexcept {
+    return offset == other.offset && size == other.size;
   }
+  [[nodiscard]] bool operator!=(const BinRange &other) const noexcept { return !(*this == other); }
+};
+}  // namespace
 
-  const auto status = arrow::ExportChunkedArray(std::move(column), array_stream);
-  if (!status.ok()) {
-    free(array_stream);
-    throw std::runtime_error(
-        fmt::format(FMT_STRING("Failed to export arrow::ChunkedArray as ArrowArrayStream: {}"),
-                    status.message()));
+[[nodiscard]] static BinRange parse_bin_range(const hictk::BinTable &bins,
+                                              const std::optional<std::string> &query,
+                                              hictk::GenomicInterval::Type query_type) {
+  if (!query.has_value()) {
+    return {0, bins.size()};
   }
 
-  ArrowArrayStreamXPtr ptr{array_stream, true};
-  ptr.attr("class") = "nanoarrow_array_stream";
-  ptr.attr("schema") = schema;
-  return ptr;
+  const auto gi = hictk::GenomicInterval::parse(bins.chromosomes(), *query, query_type);
+  const auto first_bin = bins.at(gi.chrom(), gi.start()).id();
+  const auto last_bin = bins.at(gi.chrom(), gi.end() > gi.start() ? gi.end() - 1 : gi.start()).id();
+
+  return {first_bin, last_bin - first_bin + 1};
 }
 
-[[nodiscard]] static Rcpp::DataFrame arrow_table_to_df(
-    const std::shared_ptr<arrow::Table> &arrow_table) {
-  assert(arrow_table);
+// Call fn with the PixelSelector returned by querying the given file.
+// This function does not interact with the R API, and can thus be called from any thread
+template <typename Fn>
+[[nodiscard]] static auto visit_selector(const hictk::File &f,
+                                         const std::optional<std::string> &range1,
+                                         const std::optional<std::string> &range2,
+                                         const hictk::balancing::Method &normalization_method,
+                                         hictk::GenomicInterval::Type query_type, Fn &&fn,
+                                         FetchProfiler *profiler = nullptr) {
+  return std::visit(
+      [&](const auto &ff) {
+        if (!range1.has_value()) {
+          assert(!range2.has_value());
+          return fn(profile_stage(profiler, "query",
+                                  [&]() { return ff.fetch(normalization_method); }));
+        }
+        if (!range2.has_value() || *range1 == *range2) {
+          return fn(profile_stage(profiler, "query", [&]() {
+            return ff.fetch(*range1, normalization_method, query_type);
+          }));
+        }
+        return fn(profile_stage(profiler, "query", [&]() {
+          return ff.fetch(*range1, *range2, normalization_method, query_type);
+        }));
+      },
+      f.get());
+}
+
+// Return the number of bins that should be merged to go from the resolution of the given bin table
+// to the requested resolution (1 when no resolution is requested)
+[[nodiscard]] static std::uint32_t get_coarsening_factor(
+    const hictk::BinTable &bins, const Rcpp::Nullable<Rcpp::NumericVector> &resolution) {
+  if (resolution.isNull()) {
+    return 1;
+  }
+
+  const auto base_resolution = bins.resolution();
+  if (base_resolution == 0) {
+    throw std::invalid_argument("coarsening is only supported for files with a fixed bin size");
+  }
 
-  auto schema_r = export_arrow_schema(arrow_table->schema());
-  const auto col_names = arrow_table->ColumnNames();
+  const auto res = Rcpp::as<double>(resolution);
+  if (!(res > 0) || res != std::floor(res) || res > std::numeric_limits<std::uint32_t>::max()) {
+    throw std::invalid_argument("resolution should be a positive integer");
+  }
+
+  const auto target_resolution = static_cast<std::uint32_t>(res);
+  if (target_resolution % base_resolution != 0) {
+    throw std::invalid_argument(
+        fmt::format(FMT_STRING("resolution should be a multiple of the file resolution ({})"),
+                    base_resolution));
+  }
 
-  Rcpp::List columns_r(arrow_table->num_columns());
+  return target_resolution / base_resolution;
+}
 
-  auto nanoarrow = Rcpp::Environment::namespace_env("nanoarrow");
-  const Rcpp::Function nanoarrow_convert_array_stream{nanoarrow["convert_array_stream"]};
+[[nodiscard]] static std::shared_ptr<const hictk::BinTable> coarsen_bins(
+    std::shared_ptr<const hictk::BinTable> bins, std::uint32_t coarsening_factor) {
+  if (coarsening_factor < 2) {
+    return bins;
+  }
+  return std::make_shared<const hictk::BinTable>(bins->chromosomes(),
+                                                 bins->resolution() * coarsening_factor);
+}
 
-  for (R_xlen_t i = 0; i < columns_r.size(); ++i) {
-    columns_r[i] = nanoarrow_convert_array_stream(export_arrow_array_stream(
-        arrow_table->column(hictk::conditional_static_cast<int>(i)), schema_r));
+// Call fn with the range of pixels returned by the given PixelSelector.
+// When coarsening_factor > 1, pixels are coarsened on the fly by summing the interactions of
+// blocks of coarsening_factor x coarsening_factor pixels: the base pixels are thus read only once,
+// and are never materialized in memory.
+// When an ExpectedTransform is given, the interactions of each pixel are replaced by their
+// observed/expected ratio or expected value.
+template <typename N, typename PixelSelector, typename Fn>
+static auto visit_pixels(const PixelSelector &sel, std::uint32_t coarsening_factor, Fn &&fn,
+                         const ExpectedTransform &transform = {}) {
+  if (transform.expected) {
+    assert(coarsening_factor < 2);
+    const auto [first, last] = transform.expected->transform<N>(
+        sel.template begin<double>(), sel.template end<double>(), transform.obs_over_exp);
+    return fn(first, last);
+  }
+  if (coarsening_factor < 2) {
+    return fn(sel.template begin<N>(), sel.template end<N>());
   }
+  hictk::transformers::CoarsenPixels coarsener(sel.template begin<N>(), sel.template end<N>(),
+                                               sel.bins_ptr(), coarsening_factor);
+  return fn(coarsener.begin(), coarsener.end());
+}
 
-  columns_r.attr("names") = Rcpp::CharacterVector(col_names.begin(), col_names.end());
+// Same as make_arrow_df(), but pixels are read from an iterator range, so that they can be
+// coarsened or transformed on the fly
+template <typename N, typename PixelSelector>
+[[nodiscard]] static std::shared_ptr<arrow::Table> make_coarsened_arrow_df(
+    const PixelSelector &sel, std::uint32_t coarsening_factor, bool join,
+    hictk::transformers::QuerySpan span, std::optional<std::uint64_t> diagonal_band_width,
+    const ExpectedTransform &transform) {
+  const auto format =
+      join ? hictk::transformers::DataFrameFormat::BG2 : hictk::transformers::DataFrameFormat::COO;
+  const auto bins = coarsen_bins(sel.bins_ptr(), coarsening_factor);
+  return visit_pixels<N>(
+      sel, coarsening_factor,
+      [&](auto first, auto last) {
+        return hictk::transformers::ToDataFrame(first, last, format, bins, span, false, 256'000,
+                                                diagonal_band_width)();
+      },
+      transform);
+}
 
-  auto base = Rcpp::Environment::base_namespace();
-  const Rcpp::Function as_data_frame = base["as.data.frame"];
+// Same as make_arrow_df(), but reading pixels and assembling the arrow::Table are carried out (and
+// timed) as two separate stages
+template <typename N, typename PixelSelector>
+[[nodiscard]] static std::shared_ptr<arrow::Table> make_arrow_df_profiled(
+    const PixelSelector &sel, std::uint32_t coarsening_factor, bool join,
+    hictk::transformers::QuerySpan span, std::optional<std::uint64_t> diagonal_band_width,
+    const ExpectedTransform &transform, FetchProfiler &profiler) {
+  const auto pixels = profiler.time("read_pixels", [&]() {
+    return visit_pixels<N>(
+        sel, coarsening_factor,
+        [](auto first, auto last) { return std::vector<hictk::ThinPixel<N>>(first, last); },
+        transform);
+  });
+  profiler.add_counter("pixels_read", static_cast<double>(pixels.size()));
+
+  const auto format =
+      join ? hictk::transformers::DataFrameFormat::BG2 : hictk::transformers::DataFrameFormat::COO;
+  auto table = profiler.time("to_dataframe", [&]() {
+    return hictk::transformers::ToDataFrame(pixels.begin(), pixels.end(), format,
+                                            coarsen_bins(sel.bins_ptr(), coarsening_factor),
+                                            span, false, 256'000, diagonal_band_width)();
+  });
+  profiler.add_counter("rows", static_cast<double>(table->num_rows()));
 
-  return as_data_frame(columns_r);
+  return table;
 }
 
-template <typename N, bool join, typename PixelSelector>
-[[nodiscard]] static Rcpp::DataFrame make_df(
-    const PixelSelector &sel,
+// This function does not interact with the R API, and can thus be called from any thread
+template <typename N>
+[[nodiscard]] static std::shared_ptr<arrow::Table> fetch_arrow_df(
+    const hictk::File &f, const std::optional<std::string> &range1,
+    const std::optional<std::string> &range2, const hictk::balancing::Method &normalization_method,
+    bool join, hictk::GenomicInterval::Type query_type,
     hictk::transformers::QuerySpan span = hictk::transformers::QuerySpan::upper_triangle,
-    std::optional<std::uint64_t> diagonal_band_width = {}) {
-  if constexpr (join) {
-    return arrow_table_to_df(make_bg2_arrow_df<N>(sel, span, diagonal_band_width));
-  } else {
-    return arrow_table_to_df(make_coo_arrow_df<N>(sel, span, diagonal_band_width));
+    std::optional<std::uint64_t> diagonal_band_width = {}, std::uint32_t coarsening_factor = 1,
+    const ExpectedTransform &transform = {}, FetchProfiler *profiler = nullptr) {
+  return visit_selector(
+      f, range1, range2, normalization_method, query_type,
+      [&](const auto &sel) {
+        if (profiler) {
+          return make_arrow_df_profiled<N>(sel, coarsening_factor, join, span,
+                                           diagonal_band_width, transform, *profiler);
+        }
+        if (coarsening_factor > 1 || transform.expected) {
+          return make_coarsened_arrow_df<N>(sel, coarsening_factor, join, span,
+                                            diagonal_band_width, transform);
+        }
+        return make_arrow_df<N>(sel, join, span, diagonal_band_width);
+      },
+      profiler);
+}
+
+using ChromPair = std::pair<hictk::Chromosome, hictk::Chromosome>;
+
+// List the chromosome pairs overlapping the upper triangle of a genome-wide query.
+// Pairs are returned in the order in which their pixels are first encountered when traversing the
+// genome-wide matrix row by row
+[[nodiscard]] static std::vector<ChromPair> genome_wide_chrom_pairs(
+    const hictk::Reference &chroms) {
+  std::vector<ChromPair> chrom_pairs{};
+  for (const auto &chrom1 : chroms) {
+    if (chrom1.is_all()) {
+      continue;
+    }
+    for (const auto &chrom2 : chroms) {
+      if (!chrom2.is_all() && chrom2.id() >= chrom1.id()) {
+        chrom_pairs.emplace_back(chrom1, chrom2);
+      }
+    }
   }
+  return chrom_pairs;
 }
 
-[[nodiscard]] static hictk::balancing::Method to_hictk_normalization_method(
-    const Rcpp::Nullable<Rcpp::String> &name) {
-  if (name.isNull() || Rcpp::as<Rcpp::String>(name) == "NONE") {
-    return hictk::balancing::Method::NONE();
+// Call fn(f, chrom_pair_id) for each chromosome pair using the threads from the given pool.
+// Each worker queries its own file handle (obtained by calling open_handle()) and pulls the next
+// chromosome pair as soon as it becomes idle, as the number of pixels varies greatly across pairs.
+// This function only returns after all workers are done, even when one or more of them throw: the
+// first exception is then rethrown
+template <typename OpenHandle, typename Fn>
+static void for_each_chrom_pair_parallel(BS::thread_pool<> &tpool, std::size_t num_chrom_pairs,
+                                         const OpenHandle &open_handle, const Fn &fn) {
+  std::atomic<std::size_t> next_chrom_pair{0};
+  std::vector<std::future<void>> futures{};
+  for (std::size_t i = 0; i < tpool.get_thread_count(); ++i) {
+    futures.emplace_back(tpool.submit_task([&]() {
+      try {
+        const hictk::File f = open_handle();
+        for (auto j = next_chrom_pair++; j < num_chrom_pairs; j = next_chrom_pair++) {
+          fn(f, j);
+        }
+      } catch (...) {
+        // stop the other workers as soon as they are done with the current chromosome pair
+        next_chrom_pair = num_chrom_pairs;
+        throw;
+      }
+    }));
+  }
+
+  for (auto &fut : futures) {
+    fut.wait();
+  }
+  for (auto &fut : futures) {
+    fut.get();
   }
-  return hictk::balancing::Method{Rcpp::as<std::string>(name)};
+}
+
+namespace {
+// Iterate over the pixels overlapping chromosome pairs (chrom1, chrom2), (chrom1, chrom2 + 1), ...
+// in the order given by bin1_id and bin2_id.
+// As pairs are ordered by chrom2, this only requires interleaving the pixels of each pair row by
+// row: pixels are never sorted nor copied into an intermediate vector
+template <typename N>
+class ChromPairMergeIterator {
+  using Range = std::pair<const hictk::ThinPixel<N> *, const hictk::ThinPixel<N> *>;
+  std::vector<Range> _ranges{};
+  std::size_t _i{};  // index of the range the current pixel comes from
+  std::uint64_t _bin1_id{};
+
+ public:
+  using difference_type = std::ptrdiff_t;
+  using value_type = hictk::ThinPixel<N>;
+  using pointer = const value_type *;
+  using reference = const value_type &;
+  using iterator_category = std::forward_iterator_tag;
+
+  ChromPairMergeIterator() = default;
+  template <typename It>
+  ChromPairMergeIterator(It first, It last) {
+    for (auto it = first; it != last; ++it) {
+      _ranges.emplace_back(it->data(), it->data() + it->size());
+    }
+    seek_next_row();
+  }
+  [[nodiscard]] static ChromPairMergeIterator at_end(std::size_t num_ranges) {
+    ChromPairMergeIterator it{};
+    it._i = num_ranges;
+    return it;
+  }
+
+  [[nodiscard]] reference operator*() const { return *_ranges[_i].first; }
+  [[nodiscard]] pointer operator->() const { return _ranges[_i].first; }
+
+  ChromPairMergeIterator &operator++() {
+    ++_ranges[_i].first;
+    if (has_row(_i)) {
+      return *this;
+    }
+    for (++_i; _i < _ranges.size(); ++_i) {
+      if (has_row(_i)) {
+        return *this;
+      }
+    }
+    seek_next_row();
+    return *this;
+  }
+
+  ChromPairMergeIterator operator++(int) {
+    auto it = *this;
+    ++(*this);
+    return it;
+  }
+
+  [[nodiscard]] bool operator==(const ChromPairMergeIterator &other) const {
+    if (is_end() || other.is_end()) {
+      return is_end() == other.is_end();
+    }
+    return _i == other._i && _ranges[_i].first == other._ranges[other._i].first;
+  }
+  [[nodiscard]] bool operator!=(const ChromPairMergeIterator &other) const {
+    return !(*this == other);
+  }
+
+ private:
+  [[nodiscard]] bool is_end() const noexcept { return _i >= _ranges.size(); }
+
+  [[nodiscard]] bool has_row(std::size_t i) const {
+    const auto &[first, last] = _ranges[i];
+    return first != last && first->bin1_id == _bin1_id;
+  }
+
+  // Move to the first pixel of the next row of the genome-wide matrix
+  void seek_next_row() {
+    _bin1_id = std::numeric_limits<std::uint64_t>::max();
+    _i = _ranges.size();
+    for (std::size_t i = 0; i < _ranges.size(); ++i) {
+      const auto &[first, last] = _ranges[i];
+      if (first != last && first->bin1_id < _bin1_id) {
+        _bin1_id = first->bin1_id;
+        _i = i;
+      }
+    }
+  }
+};
+}  // namespace
+
+// Fetch the upper triangle of the genome-wide matrix by querying chromosome pairs in parallel.
+// The tables for each chromosome are then concatenated in order, so that the resulting table is
+// identical to that returned by fetch_arrow_df().
+// This function does not interact with the R API, and can thus be called from any thread
+template <typename N, typename OpenHandle>
+[[nodiscard]] static std::shared_ptr<arrow::Table> fetch_genome_wide_arrow_df_parallel(
+    const hictk::File &f, const OpenHandle &open_handle,
+    const hictk::balancing::Method &normalization_method, bool join,
+    std::optional<std::uint64_t> diagonal_band_width, std::uint32_t coarsening_factor,
+    std::size_t threads, FetchProfiler *profiler) {
+  const auto chrom_pairs = genome_wide_chrom_pairs(f.chromosomes());
+  std::vector<std::vector<hictk::ThinPixel<N>>> pixels(chrom_pairs.size());
+  BS::thread_pool<> tpool(std::min(threads, chrom_pairs.size()));
+  profile_stage(profiler, "read_pixels", [&]() {
+    for_each_chrom_pair_parallel(
+        tpool, chrom_pairs.size(), open_handle, [&](const hictk::File &ff, std::size_t i) {
+          const auto &[chrom1, chrom2] = chrom_pairs[i];
+          pixels[i] = visit_selector(ff, std::string{chrom1.name()}, std::string{chrom2.name()},
+                                     normalization_method, hictk::GenomicInterval::Type::UCSC,
+                                     [&](const auto &sel) {
+                                       return visit_pixels<N>(
+                                           sel, coarsening_factor, [](auto first, auto last) {
+                                             return std::vector<hictk::ThinPixel<N>>(first, last);
+                                           });
+                                     });
+        });
+  });
+
+  if (profiler) {
+    const auto pixels_read =
+        std::accumulate(pixels.begin(), pixels.end(), std::size_t{0},
+                        [](std::size_t n, const auto &v) { return n + v.size(); });
+    profiler->add_counter("pixels_read", static_cast<double>(pixels_read));
+  }
+
+  // Pairs sharing the same chrom1 cover the same rows of the genome-wide matrix
+  std::vector<std::size_t> row_offsets{0};
+  for (std::size_t i = 1; i < chrom_pairs.size(); ++i) {
+    if (chrom_pairs[i].first.id() != chrom_pairs[i - 1].first.id()) {
+      row_offsets.push_back(i);
+    }
+  }
+  row_offsets.push_back(chrom_pairs.size());
+
+  const auto num_rows = row_offsets.size() - 1;
+  const auto bins = coarsen_bins(
+      std::visit([](const auto &ff) { return ff.bins_ptr(); }, f.get()), coarsening_factor);
+  const auto format =
+      join ? hictk::transformers::DataFrameFormat::BG2 : hictk::transformers::DataFrameFormat::COO;
+
+  std::vector<std::shared_ptr<arrow::Table>> tables(num_rows);
+  auto process_row = [&](std::size_t i) {
+    const auto first = pixels.begin() + static_cast<std::ptrdiff_t>(row_offsets[i]);
+    const auto last = pixels.begin() + static_cast<std::ptrdiff_t>(row_offsets[i + 1]);
+    tables[i] = hictk::transformers::ToDataFrame(
+        ChromPairMergeIterator<N>{first, last},
+        ChromPairMergeIterator<N>::at_end(static_cast<std::size_t>(last - first)), format, bins,
+        hictk::transformers::QuerySpan::upper_triangle, false, 256'000, diagonal_band_width)();
+
+    // Pixels are no longer needed once they have been converted to an arrow::Table
+    for (auto it = first; it != last; ++it) {
+      std::vector<hictk::ThinPixel<N>>{}.swap(*it);
+    }
+  };
+
+  auto table = profile_stage(profiler, "to_dataframe", [&]() {
+    tpool.submit_loop(std::size_t{0}, num_rows, process_row).get();
+    return concat_arrow_tables(tables);
+  });
+
+  if (profiler) {
+    profiler->add_counter("rows", static_cast<double>(table->num_rows()));
+  }
+  return table;
+}
+
+ExpectedTransform HiCFile::get_expected_transform(const hictk::balancing::Method &normalization,
+                                                  std::uint32_t coarsening_factor) const {
+  if (!is_cooler() || _matrix_type == hictk::hic::MatrixType::observed) {
+    return {};
+  }
+  if (coarsening_factor > 1) {
+    throw std::invalid_argument(
+        "resolution is not supported when fetching oe or expected matrices from Cooler files");
+  }
+  return {get_expected_values(normalization).get(), _matrix_type == hictk::hic::MatrixType::oe};
+}
+
+void HiCFile::check_matrix_type_supported() const {
+  if (is_cooler() && _matrix_type != hictk::hic::MatrixType::observed) {
+    throw std::invalid_argument(
+        "oe and expected matrices can only be fetched from Cooler files as data frames, arrow "
+        "streams, or dense matrices");
+  }
+}
+
+std::shared_ptr<arrow::Table> HiCFile::fetch_arrow_table(
+    Rcpp::Nullable<Rcpp::String> range1, Rcpp::Nullable<Rcpp::String> range2,
+    Rcpp::Nullable<Rcpp::String> normalization, std::string count_type, bool join,
+    const std::string &query_type, const std::string &span,
+    Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+    Rcpp::Nullable<Rcpp::NumericVector> resolution, int threads, FetchProfiler *profiler) const {
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+
+  if (threads < 1) {
+    throw std::invalid_argument("threads should be a positive number");
+  }
+
+  const auto range1_str = to_optional_string(range1);
+  const auto query_span = parse_query_span(span);
+  const auto band_width = to_optional_band_width(diagonal_band_width);
+  const auto coarsening_factor = get_coarsening_factor(_fp->bins(), resolution);
+  const auto exp_transform = get_expected_transform(normalization_method, coarsening_factor);
+
+  if ((normalization_method != "NONE" || exp_transform.expected) && count_type == "int") {
+    count_type = "float";
+  }
+
+  // Genome-wide queries on .hic files can be split by chromosome pair and processed in parallel.
+  // The HDF5 library used by hictk is not thread-safe: queries targeting Cooler files are thus
+  // always processed sequentially
+  const auto parallel = threads > 1 && is_hic() && !range1_str.has_value() &&
+                        query_span == hictk::transformers::QuerySpan::upper_triangle;
+
+  return visit_count_type(count_type, [&](auto count) {
+    using N = decltype(count);
+    if (parallel) {
+      return fetch_genome_wide_arrow_df_parallel<N>(
+          *_fp, [this]() { return open_handle(); }, normalization_method, join, band_width,
+          coarsening_factor, static_cast<std::size_t>(threads), profiler);
+    }
+    return fetch_arrow_df<N>(*_fp, range1_str, to_optional_string(range2), normalization_method,
+                             join, parse_query_type(query_type), query_span, band_width,
+                             coarsening_factor, exp_transform, profiler);
+  });
 }
 
 Rcpp::DataFrame HiCFile::fetch_df(Rcpp::Nullable<Rcpp::String> range1,
                                   Rcpp::Nullable<Rcpp::String> range2,
                                   Rcpp::Nullable<Rcpp::String> normalization,
-                                  std::string count_type, bool join, std::string query_type) const {
+                                  std::string count_type, bool join, std::string query_type,
+                                  std::string span,
+                                  Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                  Rcpp::Nullable<Rcpp::NumericVector> resolution, int threads,
+                                  bool profile) const {
+  auto fetch = [&](FetchProfiler *profiler) {
+    auto table =
+        fetch_arrow_table(range1, range2, normalization, std::move(count_type), join, query_type,
+                          span, diagonal_band_width, resolution, threads, profiler);
+    return profile_stage(profiler, "r_conversion",
+                         [&]() { return arrow_table_to_df(std::move(table)); });
+  };
+
+  if (!profile) {
+    return fetch(nullptr);
+  }
+
+  FetchProfiler profiler{};
+  auto df = fetch(&profiler);
+  df.attr("profile") = profiler.to_list();
+  return df;
+}
+
+Rcpp::RObject HiCFile::fetch_arrow(Rcpp::Nullable<Rcpp::String> range1,
+                                   Rcpp::Nullable<Rcpp::String> range2,
+                                   Rcpp::Nullable<Rcpp::String> normalization,
+                                   std::string count_type, bool join, std::string query_type,
+                                   std::string span,
+                                   Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                   Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                   int threads) const {
+  return export_arrow_table(fetch_arrow_table(range1, range2, normalization, std::move(count_type),
+                                              join, query_type, span, diagonal_band_width,
+                                              resolution, threads, nullptr));
+}
+
+Rcpp::DataFrame HiCFile::expected_values(Rcpp::Nullable<Rcpp::String> normalization) const {
+  return get_expected_values(to_hictk_normalization_method(normalization))->to_df();
+}
+
+Rcpp::RObject HiCFile::fetch_batch(Rcpp::CharacterVector range1,
+                                   Rcpp::Nullable<Rcpp::CharacterVector> range2,
+                                   Rcpp::Nullable<Rcpp::String> normalization,
+                                   std::string count_type, bool join, std::string query_type,
+                                   int threads, bool combine) const {
+  check_matrix_type_supported();
+
+  if (count_type != "int" && count_type != "float") {
+    throw std::invalid_argument("count_type should be either \"int\" or \"float\"");
+  }
+
   const auto normalization_method = to_hictk_normalization_method(normalization);
   if (normalization_method != "NONE") {
     count_type = "float";
   }
 
-  if (range1.isNull()) {
-    assert(range2.isNull());
-    return std::visit(
-        [&](const auto &ff) {
-          auto sel = ff.fetch(normalization_method);
-          if (count_type == "int") {
-            return join ? make_df<std::int32_t, true>(sel) : make_df<std::int32_t, false>(sel);
-          }
-          return join ? make_df<double, true>(sel) : make_df<double, false>(sel);
-        },
-        _fp.get());
+  const auto queries1 = Rcpp::as<std::vector<std::string>>(range1);
+  const auto queries2 =
+      range2.isNull() ? queries1 : Rcpp::as<std::vector<std::string>>(range2.get());
+
+  if (queries1.empty()) {
+    throw std::invalid_argument("range1 should contain at least one query");
+  }
+  if (queries1.size() != queries2.size()) {
+    throw std::invalid_argument("range1 and range2 should have the same length");
+  }
+  if (threads < 1) {
+    throw std::invalid_argument("threads should be a positive number");
   }
 
-  const auto qt =
-      query_type == "UCSC" ? hictk::GenomicInterval::Type::UCSC : hictk::GenomicInterval::Type::BED;
+  const auto qt = parse_query_type(query_type);
+  const auto int_counts = count_type == "int";
+  const auto num_queries = queries1.size();
 
-  return std::visit(
-      [&](const auto &ff) {
-        auto sel = range2.isNull() || range1 == range2
-                       ? ff.fetch(Rcpp::as<std::string>(range1), normalization_method, qt)
-                       : ff.fetch(Rcpp::as<std::string>(range1), Rcpp::as<std::string>(range2),
-                                  normalization_method, qt);
-        if (count_type == "int") {
-          return join ? make_df<std::int32_t, true>(sel) : make_df<std::int32_t, false>(sel);
-        }
-        return join ? make_df<double, true>(sel) : make_df<double, false>(sel);
-      },
-      _fp.get());
+  std::vector<std::shared_ptr<arrow::Table>> tables(num_queries);
+  auto process_queries = [&](const hictk::File &f, std::size_t first, std::size_t last) {
+    for (auto i = first; i < last; ++i) {
+      tables[i] = int_counts ? fetch_arrow_df<std::int32_t>(f, queries1[i], queries2[i],
+                                                            normalization_method, join, qt)
+                             : fetch_arrow_df<double>(f, queries1[i], queries2[i],
+                                                      normalization_method, join, qt);
+    }
+  };
+
+  // The HDF5 library used by hictk is not thread-safe: queries targeting Cooler files are thus
+  // always processed sequentially
+  const auto num_workers =
+      is_hic() ? std::min(static_cast<std::size_t>(threads), num_queries) : std::size_t{1};
+
+  if (num_workers == 1) {
+    process_queries(*_fp, 0, num_queries);
+  } else {
+    BS::thread_pool<> tpool(num_workers);
+    std::vector<std::future<void>> futures{};
+
+    const auto batch_size = (num_queries + num_workers - 1) / num_workers;
+    for (std::size_t first = 0; first < num_queries; first += batch_size) {
+      const auto last = std::min(first + batch_size, num_queries);
+      futures.emplace_back(tpool.submit_task([&, first, last]() {
+        const auto f = open_handle();
+        process_queries(f, first, last);
+      }));
+    }
+
+    for (auto &fut : futures) {
+      fut.wait();
+    }
+    for (auto &fut : futures) {
+      fut.get();
+    }
+  }
+
+  if (combine) {
+    return arrow_table_to_df(concat_arrow_tables(tables, "query_id"));
+  }
+
+  Rcpp::List dfs(static_cast<R_xlen_t>(num_queries));
+  for (std::size_t i = 0; i < num_queries; ++i) {
+    dfs[static_cast<R_xlen_t>(i)] = arrow_table_to_df(std::move(tables[i]));
+  }
+  return dfs;
+}
+
+PixelStream *HiCFile::fetch_stream(Rcpp::Nullable<Rcpp::String> range1,
+                                   Rcpp::Nullable<Rcpp::String> range2,
+                                   Rcpp::Nullable<Rcpp::String> normalization,
+                                   std::string count_type, bool join, std::string query_type,
+                                   std::int64_t chunk_size) const {
+  check_matrix_type_supported();
+
+  if (count_type != "int" && count_type != "float") {
+    throw std::invalid_argument("count_type should be either \"int\" or \"float\"");
+  }
+
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+  if (normalization_method != "NONE") {
+    count_type = "float";
+  }
+
+  if (chunk_size <= 0) {
+    throw std::invalid_argument("chunk_size should be a positive number");
+  }
+
+  return new PixelStream(open_handle(), to_optional_string(range1), to_optional_string(range2),
+                         normalization_method, count_type == "int", join,
+                         parse_query_type(query_type), static_cast<std::size_t>(chunk_size));
+}
+
+double HiCFile::fetch_to_file(std::string path, Rcpp::Nullable<Rcpp::String> range1,
+                              Rcpp::Nullable<Rcpp::String> range2,
+                              Rcpp::Nullable<Rcpp::String> normalization,
+                              std::string count_type, bool join, std::string query_type,
+                              std::string format, std::int64_t chunk_size, bool force) const {
+  check_matrix_type_supported();
+
+  if (format != "arrow_ipc") {
+    throw std::invalid_argument("format should be \"arrow_ipc\"");
+  }
+
+  if (chunk_size <= 0) {
+    throw std::invalid_argument("chunk_size should be a positive number");
+  }
+
+  if (!force && std::filesystem::exists(path)) {
+    throw std::runtime_error(fmt::format(
+        FMT_STRING("file \"{}\" already exists: pass force=TRUE to overwrite it"), path));
+  }
+
+  if (count_type != "int" && count_type != "float") {
+    throw std::invalid_argument("count_type should be either \"int\" or \"float\"");
+  }
+
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+  if (normalization_method != "NONE") {
+    count_type = "float";
+  }
+
+  // Pixels are read and written one chunk at a time: only a single chunk of pixels (and the
+  // corresponding arrow::Table) is ever kept in memory
+  PixelStream stream(open_handle(), to_optional_string(range1), to_optional_string(range2),
+                     normalization_method, count_type == "int", join, parse_query_type(query_type),
+                     static_cast<std::size_t>(chunk_size));
+  ArrowIpcFileWriter writer(std::move(path), stream.schema());
+  while (const auto table = stream.next_table()) {
+    writer.write(*table);
+  }
+  writer.close();
+
+  return static_cast<double>(writer.rows_written());
+}
+
+// R matrix used to store interactions of type N.
+// R has no single-precision type: float interactions are thus stored as the raw bits of an
+// IntegerMatrix, following the representation used by the float32 class from the float package
+template <typename N>
+using RcppMatrix =
+    std::conditional_t<std::is_same_v<N, double>, Rcpp::NumericMatrix, Rcpp::IntegerMatrix>;
+
+template <typename N>
+[[nodiscard]] static auto matrix_data(RcppMatrix<N> &matrix) {
+  if constexpr (std::is_same_v<N, float>) {
+    static_assert(sizeof(float) == sizeof(int));
+    return reinterpret_cast<float *>(matrix.begin());  // NOLINT
+  } else {
+    return matrix.begin();
+  }
 }
 
-template <typename N, typename PixelSelector,
-          typename RcppMatrixT =
-              std::conditional_t<std::is_integral_v<N>, Rcpp::IntegerMatrix, Rcpp::NumericMatrix>>
-static RcppMatrixT fetch_as_matrix(PixelSelector &&sel) {
-  return Rcpp::wrap(hictk::transformers::ToDenseMatrix(std::move(sel), N{})());
+template <typename N>
+[[nodiscard]] static Rcpp::RObject to_r_matrix(RcppMatrix<N> matrix) {
+  if constexpr (std::is_same_v<N, float>) {
+    Rcpp::S4 float_matrix("float32");
+    float_matrix.slot("Data") = matrix;
+    return float_matrix;
+  } else {
+    return matrix;
+  }
+}
+
+namespace {
+// Write pixels into the (column-major) storage of a dense matrix through an Eigen::Map, so that no
+// intermediate matrix is ever materialized.
+// Pixels are mirrored below the diagonal according to the given span.
+// Writers do not interact with the R API: copies of the same writer can thus be used to fill
+// disjoint regions of a matrix from different threads.
+template <typename N>
+class DenseMatrixWriter {
+  using MatrixN = std::conditional_t<std::is_integral_v<N>, int, N>;
+  Eigen::Map<Eigen::Matrix<MatrixN, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>> _buffer;
+  BinRange _rows{};
+  BinRange _cols{};
+  bool _emit_upper{};
+  bool _emit_lower{};
+  std::uint64_t _band_width{};
+
+ public:
+  DenseMatrixWriter(MatrixN *data, const BinRange &rows, const BinRange &cols,
+                    hictk::transformers::QuerySpan span,
+                    std::optional<std::uint64_t> diagonal_band_width)
+      : _buffer(data, static_cast<Eigen::Index>(rows.size), static_cast<Eigen::Index>(cols.size)),
+        _rows(rows),
+        _cols(cols),
+        _emit_upper(span != hictk::transformers::QuerySpan::lower_triangle),
+        _emit_lower(span != hictk::transformers::QuerySpan::upper_triangle),
+        _band_width(diagonal_band_width.value_or(std::numeric_limits<std::uint64_t>::max())) {}
+
+  // Write pixels in range [first, last) and return the number of pixels that were read
+  template <typename PixelIt>
+  std::uint64_t write(PixelIt first, PixelIt last) {
+    std::uint64_t pixels_read = 0;
+    for (; first != last; ++first, ++pixels_read) {
+      const hictk::ThinPixel<N> &p = *first;
+      if (p.bin2_id - p.bin1_id >= _band_width) {
+        continue;
+      }
+      const auto diagonal = p.bin1_id == p.bin2_id;
+      if ((_emit_upper || diagonal) && _rows.contains(p.bin1_id) && _cols.contains(p.bin2_id)) {
+        _buffer(static_cast<Eigen::Index>(p.bin1_id - _rows.offset),
+                static_cast<Eigen::Index>(p.bin2_id - _cols.offset)) = p.count;
+      }
+      if (_emit_lower && !diagonal && _rows.contains(p.bin2_id) && _cols.contains(p.bin1_id)) {
+        _buffer(static_cast<Eigen::Index>(p.bin2_id - _rows.offset),
+                static_cast<Eigen::Index>(p.bin1_id - _cols.offset)) = p.count;
+      }
+    }
+    return pixels_read;
+  }
+};
+}  // namespace
+
+template <typename N>
+[[nodiscard]] static RcppMatrix<N> allocate_matrix(const BinRange &rows, const BinRange &cols,
+                                                 FetchProfiler *profiler) {
+  constexpr auto max_size = static_cast<std::uint64_t>(std::numeric_limits<int>::max());
+  if (rows.size > max_size || cols.size > max_size) {
+    throw std::runtime_error("matrix dimensions cannot exceed INT_MAX");
+  }
+
+  return profile_stage(profiler, "allocate", [&]() {
+    return RcppMatrix<N>(static_cast<int>(rows.size), static_cast<int>(cols.size));
+  });
+}
+
+// Fetch the first diagonal_band_width diagonals of a symmetric query using band storage:
+// element (i, d) of the returned matrix corresponds to element (i, i + d) of the full matrix.
+template <typename N, typename PixelIt>
+static RcppMatrix<N> fetch_as_band_matrix(PixelIt first, PixelIt last, const BinRange &bins,
+                                          std::uint64_t diagonal_band_width,
+                                          FetchProfiler *profiler) {
+  const auto num_diagonals = std::min(diagonal_band_width, bins.size);
+  constexpr auto max_size = static_cast<std::uint64_t>(std::numeric_limits<int>::max());
+  if (bins.size > max_size) {
+    throw std::runtime_error("matrix dimensions cannot exceed INT_MAX");
+  }
+
+  auto matrix = profile_stage(profiler, "allocate", [&]() {
+    return RcppMatrix<N>(static_cast<int>(bins.size), static_cast<int>(num_diagonals));
+  });
+
+  using MatrixN = std::conditional_t<std::is_integral_v<N>, int, N>;
+  Eigen::Map<Eigen::Matrix<MatrixN, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor>> buffer(
+      matrix_data<N>(matrix), static_cast<Eigen::Index>(bins.size),
+      static_cast<Eigen::Index>(num_diagonals));
+
+  std::uint64_t pixels_read = 0;
+  auto fill_matrix = [&](const hictk::ThinPixel<N> &p) {
+    ++pixels_read;
+    if (!bins.contains(p.bin1_id) || !bins.contains(p.bin2_id)) {
+      return;
+    }
+    const auto [bin1_id, bin2_id] = std::minmax(p.bin1_id, p.bin2_id);
+    const auto diagonal = bin2_id - bin1_id;
+    if (diagonal < num_diagonals) {
+      buffer(static_cast<Eigen::Index>(bin1_id - bins.offset),
+             static_cast<Eigen::Index>(diagonal)) = p.count;
+    }
+  };
+
+  profile_stage(profiler, "read_pixels", [&]() { std::for_each(first, last, fill_matrix); });
+
+  if (profiler) {
+    profiler->add_counter("pixels_read", static_cast<double>(pixels_read));
+  }
+
+  return matrix;
+}
+
+// Fill a dense matrix with the upper triangle of the genome-wide matrix by querying chromosome
+// pairs in parallel. As each pair maps to its own block(s) of the matrix, workers never write to
+// the same region of memory.
+// Return the number of pixels that were read
+template <typename N, typename OpenHandle>
+static std::uint64_t fill_genome_wide_matrix_parallel(
+    const hictk::File &f, const OpenHandle &open_handle,
+    const hictk::balancing::Method &normalization_method, const DenseMatrixWriter<N> &writer,
+    std::uint32_t coarsening_factor, std::size_t threads) {
+  const auto chrom_pairs = genome_wide_chrom_pairs(f.chromosomes());
+  std::atomic<std::uint64_t> pixels_read{0};
+  BS::thread_pool<> tpool(std::min(threads, chrom_pairs.size()));
+
+  for_each_chrom_pair_parallel(
+      tpool, chrom_pairs.size(), open_handle, [&](const hictk::File &ff, std::size_t i) {
+        const auto &[chrom1, chrom2] = chrom_pairs[i];
+        auto w = writer;
+        pixels_read += visit_selector(
+            ff, std::string{chrom1.name()}, std::string{chrom2.name()}, normalization_method,
+            hictk::GenomicInterval::Type::UCSC,
+            [&](const auto &sel) {
+              return visit_pixels<N>(sel, coarsening_factor,
+                                     [&](auto first, auto last) { return w.write(first, last); });
+            });
+      });
+
+  return pixels_read;
 }
 
 Rcpp::RObject HiCFile::fetch_dense(Rcpp::Nullable<Rcpp::String> range1,
                                    Rcpp::Nullable<Rcpp::String> range2,
                                    Rcpp::Nullable<Rcpp::String> normalization,
-                                   std::string count_type, std::string query_type) const {
+                                   std::string count_type, std::string query_type,
+                                   std::string span,
+                                   Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                   bool band_storage,
+                                   Rcpp::Nullable<Rcpp::NumericVector> resolution, int threads,
+                                   bool profile) const {
   const auto normalization_method = to_hictk_normalization_method(normalization);
-  if (normalization_method != "NONE") {
+
+  if (threads < 1) {
+    throw std::invalid_argument("threads should be a positive number");
+  }
+
+  const auto range1_str = to_optional_string(range1);
+  const auto range2_str = range2.isNull() ? range1_str : to_optional_string(range2);
+  const auto qt = parse_query_type(query_type);
+  const auto query_span = parse_query_span(span);
+  const auto band_width = to_optional_band_width(diagonal_band_width);
+
+  if (band_storage) {
+    if (!band_width.has_value()) {
+      throw std::invalid_argument("band storage requires diagonal_band_width to be specified");
+    }
+    if (range1_str != range2_str) {
+      throw std::invalid_argument("band storage is only supported for symmetric queries");
+    }
+  }
+
+  // Matrix rows and columns refer to the bins of the requested resolution
+  const auto coarsening_factor = get_coarsening_factor(_fp->bins(), resolution);
+  const auto exp_transform = get_expected_transform(normalization_method, coarsening_factor);
+  if ((normalization_method != "NONE" || exp_transform.expected) && count_type == "int") {
     count_type = "float";
   }
 
-  if (range1.isNull()) {
-    assert(range2.isNull());
-    return std::visit(
-        [&](const auto &ff) -> Rcpp::RObject {
-          auto sel = ff.fetch(normalization_method);
-          if (count_type == "int") {
-            return fetch_as_matrix<std::int64_t>(std::move(sel));
-          }
-          return fetch_as_matrix<double>(std::move(sel));
+  const auto bins = coarsen_bins(
+      std::visit([](const auto &ff) { return ff.bins_ptr(); }, _fp->get()), coarsening_factor);
+
+  // See fetch_arrow_table() for why only .hic files are processed in parallel
+  const auto parallel = threads > 1 && is_hic() && !range1_str.has_value();
+
+  auto fetch_matrix = [&](auto count, FetchProfiler *profiler) -> Rcpp::RObject {
+    using N = decltype(count);
+    const auto rows = parse_bin_range(*bins, range1_str, qt);
+    const auto cols = parse_bin_range(*bins, range2_str, qt);
+    auto matrix = allocate_matrix<N>(rows, cols, profiler);
+    DenseMatrixWriter<N> writer(matrix_data<N>(matrix), rows, cols, query_span, band_width);
+
+    std::uint64_t pixels_read{};
+    if (parallel) {
+      pixels_read = profile_stage(profiler, "read_pixels", [&]() {
+        return fill_genome_wide_matrix_parallel(
+            *_fp, [this]() { return open_handle(); }, normalization_method, writer,
+            coarsening_factor, static_cast<std::size_t>(threads));
+      });
+    } else {
+      pixels_read = visit_selector(
+          *_fp, range1_str, range2_str, normalization_method, qt,
+          [&](const auto &sel) {
+            return profile_stage(profiler, "read_pixels", [&]() {
+              return visit_pixels<N>(
+                  sel, coarsening_factor,
+                  [&](auto first, auto last) { return writer.write(first, last); },
+                  exp_transform);
+            });
+          },
+          profiler);
+    }
+
+    if (profiler) {
+      profiler->add_counter("pixels_read", static_cast<double>(pixels_read));
+    }
+
+    return to_r_matrix<N>(matrix);
+  };
+
+  auto fetch_band_matrix = [&](auto count, FetchProfiler *profiler) -> Rcpp::RObject {
+    using N = decltype(count);
+    const auto bin_range = parse_bin_range(*bins, range1_str, qt);
+    return visit_selector(
+        *_fp, range1_str, range2_str, normalization_method, qt,
+        [&](const auto &sel) {
+          return visit_pixels<N>(
+              sel, coarsening_factor,
+              [&](auto first, auto last) {
+                return to_r_matrix<N>(
+                    fetch_as_band_matrix<N>(first, last, bin_range, *band_width, profiler));
+              },
+              exp_transform);
         },
-        _fp.get());
+        profiler);
+  };
+
+  auto fetch = [&](FetchProfiler *profiler) {
+    return visit_count_type(count_type, [&](auto count) {
+      return band_storage ? fetch_band_matrix(count, profiler) : fetch_matrix(count, profiler);
+    });
+  };
+
+  if (!profile) {
+    return fetch(nullptr);
   }
 
-  const auto qt =
-      query_type == "UCSC" ? hictk::GenomicInterval::Type::UCSC : hictk::GenomicInterval::Type::BED;
+  FetchProfiler profiler{};
+  auto matrix = fetch(&profiler);
+  matrix.attr("profile") = profiler.to_list();
+  return matrix;
+}
 
-  return std::visit(
-      [&](const auto &ff) -> Rcpp::RObject {
-        auto sel = range2.isNull() || range1 == range2
-                       ? ff.fetch(Rcpp::as<std::string>(range1), normalization_method, qt)
-                       : ff.fetch(Rcpp::as<std::string>(range1), Rcpp::as<std::string>(range2),
-                                  normalization_method, qt);
-        if (count_type == "int") {
-          return fetch_as_matrix<std::int64_t>(std::move(sel));
-        }
-        return fetch_as_matrix<double>(std::move(sel));
-      },
-      _fp.get());
+// Same as the non-parallel code path of HiCFile::fetch_dense(), but the matrix is stored in a
+// buffer that is not managed by R.
+// This function does not interact with the R API, and can thus be called from any thread
+template <typename N>
+[[nodiscard]] static auto fetch_dense_buffer(const hictk::File &f,
+                                             const std::optional<std::string> &range1,
+                                             const std::optional<std::string> &range2,
+                                             const hictk::balancing::Method &normalization_method,
+                                             hictk::GenomicInterval::Type query_type,
+                                             hictk::transformers::QuerySpan span,
+                                             std::optional<std::uint64_t> diagonal_band_width,
+                                             std::uint32_t coarsening_factor,
+                                             const ExpectedTransform &transform) {
+  using MatrixN = std::conditional_t<std::is_integral_v<N>, int, N>;
+
+  const auto bins = coarsen_bins(std::visit([](const auto &ff) { return ff.bins_ptr(); }, f.get()),
+                                 coarsening_factor);
+  const auto rows = parse_bin_range(*bins, range1, query_type);
+  const auto cols = parse_bin_range(*bins, range2, query_type);
+
+  DenseMatrixBuffer<MatrixN> buffer{std::vector<MatrixN>(rows.size * cols.size), rows.size,
+                                    cols.size};
+  DenseMatrixWriter<N> writer(buffer.data.data(), rows, cols, span, diagonal_band_width);
+
+  static_cast<void>(visit_selector(
+      f, range1, range2, normalization_method, query_type, [&](const auto &sel) {
+        return visit_pixels<N>(
+            sel, coarsening_factor,
+            [&](auto first, auto last) { return writer.write(first, last); }, transform);
+      }));
+
+  return buffer;
+}
+
+FetchFuture *HiCFile::fetch_async(Rcpp::Nullable<Rcpp::String> range1,
+                                  Rcpp::Nullable<Rcpp::String> range2,
+                                  Rcpp::Nullable<Rcpp::String> normalization,
+                                  std::string count_type, bool join, std::string query_type,
+                                  std::string span,
+                                  Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                  Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                  std::string type) const {
+  if (type != "df" && type != "dense") {
+    throw std::invalid_argument("type should be either \"df\" or \"dense\"");
+  }
+  if (count_type != "int" && count_type != "float") {
+    throw std::invalid_argument("count_type should be either \"int\" or \"float\"");
+  }
+
+  // Parse all parameters on the main thread: the query itself must not interact with the R API
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+  const auto range1_str = to_optional_string(range1);
+  const auto range2_str = range2.isNull() ? range1_str : to_optional_string(range2);
+  const auto qt = parse_query_type(query_type);
+  const auto query_span = parse_query_span(span);
+  const auto band_width = to_optional_band_width(diagonal_band_width);
+  const auto coarsening_factor = get_coarsening_factor(_fp->bins(), resolution);
+  const auto exp_transform = get_expected_transform(normalization_method, coarsening_factor);
+  const auto int_counts =
+      normalization_method == "NONE" && !exp_transform.expected && count_type == "int";
+
+  auto fetch = [=](const hictk::File &f) -> FetchResult {
+    if (type == "df") {
+      if (int_counts) {
+        return fetch_arrow_df<std::int32_t>(f, range1_str, range2_str, normalization_method, join,
+                                            qt, query_span, band_width, coarsening_factor,
+                                            exp_transform);
+      }
+      return fetch_arrow_df<double>(f, range1_str, range2_str, normalization_method, join, qt,
+                                    query_span, band_width, coarsening_factor, exp_transform);
+    }
+    if (int_counts) {
+      return fetch_dense_buffer<std::int32_t>(f, range1_str, range2_str, normalization_method, qt,
+                                              query_span, band_width, coarsening_factor,
+                                              exp_transform);
+    }
+    return fetch_dense_buffer<double>(f, range1_str, range2_str, normalization_method, qt,
+                                      query_span, band_width, coarsening_factor, exp_transform);
+  };
+
+  if (is_cooler()) {
+    // See fetch_arrow_table() for why Cooler files cannot be queried from other threads: queries
+    // targeting Cooler files are thus processed right away on the main thread
+    std::packaged_task<FetchResult()> task([&]() { return fetch(*_fp); });
+    auto future = task.get_future().share();
+    task();
+    return new FetchFuture(std::move(future));
+  }
+
+  // Each query uses its own handle, so that handles are never accessed from multiple threads
+  return new FetchFuture(std::async(std::launch::async, [fetch = std::move(fetch),
+                                                         path = path(), res = resolution(),
+                                                         mt = _matrix_type, mu = _matrix_unit]() {
+                           return fetch(hictk::File{path, res, mt, mu});
+                         }).share());
+}
+
+static void sort_csc_columns(const std::vector<int> &col_ptrs, Rcpp::IntegerVector &row_idx,
+                             Rcpp::NumericVector &values) {
+  std::vector<std::pair<int, double>> buffer{};
+  for (std::size_t j = 0; j + 1 < col_ptrs.size(); ++j) {
+    const auto first = row_idx.begin() + col_ptrs[j];
+    const auto last = row_idx.begin() + col_ptrs[j + 1];
+    if (std::is_sorted(first, last)) {
+      continue;
+    }
+
+    buffer.clear();
+    for (auto k = col_ptrs[j]; k < col_ptrs[j + 1]; ++k) {
+      buffer.emplace_back(row_idx[k], values[k]);
+    }
+    std::sort(buffer.begin(), buffer.end());
+    for (std::size_t k = 0; k < buffer.size(); ++k) {
+      row_idx[col_ptrs[j] + static_cast<R_xlen_t>(k)] = buffer[k].first;
+      values[col_ptrs[j] + static_cast<R_xlen_t>(k)] = buffer[k].second;
+    }
+  }
+}
+
+// Build a sparse matrix of class dgCMatrix, dgTMatrix, or dsCMatrix directly from the pixels
+// returned by the given selector.
+// Pixels are mirrored below the diagonal according to the given span. dsCMatrix objects always
+// store the upper triangle.
+template <typename PixelSelector>
+[[nodiscard]] static Rcpp::S4 make_sparse_matrix(const PixelSelector &sel, const BinRange &rows,
+                                                 const BinRange &cols, const std::string &format,
+                                                 hictk::transformers::QuerySpan span,
+                                                 std::optional<std::uint64_t> diagonal_band_width) {
+  constexpr auto max_size = static_cast<std::uint64_t>(std::numeric_limits<int>::max());
+  if (rows.size > max_size || cols.size > max_size) {
+    throw std::runtime_error("sparse matrix dimensions cannot exceed INT_MAX");
+  }
+
+  const auto symmetric = format == "dsCMatrix";
+  if (symmetric && rows != cols) {
+    throw std::invalid_argument("dsCMatrix output is only supported for symmetric queries");
+  }
+  if (symmetric) {
+    span = hictk::transformers::QuerySpan::upper_triangle;
+  }
+
+  const auto emit_upper = span != hictk::transformers::QuerySpan::lower_triangle;
+  const auto emit_lower = span != hictk::transformers::QuerySpan::upper_triangle;
+  const auto band_width = diagonal_band_width.value_or(std::numeric_limits<std::uint64_t>::max());
+
+  std::vector<int> row_buff{};
+  std::vector<int> col_buff{};
+  std::vector<double> count_buff{};
+
+  auto push_back = [&](std::uint64_t bin1_id, std::uint64_t bin2_id, double count) {
+    row_buff.push_back(static_cast<int>(bin1_id - rows.offset));
+    col_buff.push_back(static_cast<int>(bin2_id - cols.offset));
+    count_buff.push_back(count);
+  };
+
+  std::for_each(sel.template begin<double>(), sel.template end<double>(),
+                [&](const hictk::ThinPixel<double> &p) {
+                  if (p.bin2_id - p.bin1_id >= band_width) {
+                    return;
+                  }
+                  const auto diagonal = p.bin1_id == p.bin2_id;
+                  if ((emit_upper || diagonal) && rows.contains(p.bin1_id) &&
+                      cols.contains(p.bin2_id)) {
+                    push_back(p.bin1_id, p.bin2_id, p.count);
+                  }
+                  if (emit_lower && !diagonal && rows.contains(p.bin2_id) &&
+                      cols.contains(p.bin1_id)) {
+                    push_back(p.bin2_id, p.bin1_id, p.count);
+                  }
+                });
+
+  if (count_buff.size() > max_size) {
+    throw std::runtime_error("the number of non-zero entries in a sparse matrix cannot exceed INT_MAX");
+  }
+
+  const auto num_rows = static_cast<int>(rows.size);
+  const auto num_cols = static_cast<int>(cols.size);
+
+  Rcpp::S4 matrix(format);
+  matrix.slot("Dim") = Rcpp::IntegerVector::create(num_rows, num_cols);
+
+  if (format == "dgTMatrix") {
+    matrix.slot("i") = Rcpp::IntegerVector(row_buff.begin(), row_buff.end());
+    matrix.slot("j") = Rcpp::IntegerVector(col_buff.begin(), col_buff.end());
+    matrix.slot("x") = Rcpp::NumericVector(count_buff.begin(), count_buff.end());
+    return matrix;
+  }
+
+  // Convert triplets to CSC using a counting sort on the column indices
+  const auto nnz = static_cast<R_xlen_t>(count_buff.size());
+  std::vector<int> col_ptrs(static_cast<std::size_t>(num_cols) + 1, 0);
+  for (const auto j : col_buff) {
+    ++col_ptrs[static_cast<std::size_t>(j) + 1];
+  }
+  std::partial_sum(col_ptrs.begin(), col_ptrs.end(), col_ptrs.begin());
+
+  Rcpp::IntegerVector row_idx(Rcpp::no_init(nnz));
+  Rcpp::NumericVector values(Rcpp::no_init(nnz));
+  std::vector<int> offsets(col_ptrs.begin(), col_ptrs.end() - 1);
+  for (std::size_t k = 0; k < count_buff.size(); ++k) {
+    const auto i = offsets[static_cast<std::size_t>(col_buff[k])]++;
+    row_idx[i] = row_buff[k];
+    values[i] = count_buff[k];
+  }
+
+  sort_csc_columns(col_ptrs, row_idx, values);
+
+  matrix.slot("i") = row_idx;
+  matrix.slot("p") = Rcpp::IntegerVector(col_ptrs.begin(), col_ptrs.end());
+  matrix.slot("x") = values;
+  if (symmetric) {
+    matrix.slot("uplo") = "U";
+  }
+
+  return matrix;
+}
+
+Rcpp::S4 HiCFile::fetch_sparse(Rcpp::Nullable<Rcpp::String> range1,
+                               Rcpp::Nullable<Rcpp::String> range2,
+                               Rcpp::Nullable<Rcpp::String> normalization, std::string format,
+                               std::string query_type, std::string span,
+                               Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width) const {
+  check_matrix_type_supported();
+
+  if (format != "dgCMatrix" && format != "dgTMatrix" && format != "dsCMatrix") {
+    throw std::invalid_argument(
+        "format should be one of \"dgCMatrix\", \"dgTMatrix\", or \"dsCMatrix\"");
+  }
+
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+  const auto range1_str = to_optional_string(range1);
+  const auto range2_str = range2.isNull() ? range1_str : to_optional_string(range2);
+  const auto qt = parse_query_type(query_type);
+  const auto query_span = parse_query_span(span);
+  const auto band_width = to_optional_band_width(diagonal_band_width);
+
+  const auto rows = parse_bin_range(_fp->bins(), range1_str, qt);
+  const auto cols = parse_bin_range(_fp->bins(), range2_str, qt);
+
+  return visit_selector(*_fp, range1_str, range2_str, normalization_method, qt,
+                        [&](const auto &sel) {
+                          return make_sparse_matrix(sel, rows, cols, format, query_span,
+                                                    band_width);
+                        });
+}
+
+// Split a range of genome-wide bins into ranges that do not span multiple chromosomes.
+// Return the BED query and the range of bins of each range
+[[nodiscard]] static std::vector<std::pair<std::string, BinRange>> split_bin_range_by_chrom(
+    const hictk::BinTable &bins, const BinRange &range) {
+  std::vector<std::pair<std::string, BinRange>> ranges{};
+  const auto last_bin_id = range.offset + range.size - 1;
+  for (auto first_bin_id = range.offset; first_bin_id <= last_bin_id;) {
+    const auto first_bin = bins.at(first_bin_id);
+    const auto &chrom = first_bin.chrom();
+    const auto last_bin = bins.at(std::min(last_bin_id, bins.at(chrom, chrom.size() - 1).id()));
+
+    ranges.emplace_back(
+        fmt::format(FMT_STRING("{}\t{}\t{}"), chrom.name(), first_bin.start(), last_bin.end()),
+        BinRange{first_bin_id, last_bin.id() - first_bin_id + 1});
+    first_bin_id = last_bin.id() + 1;
+  }
+  return ranges;
+}
+
+std::vector<double> HiCFile::fetch_tile(std::uint64_t x, std::uint64_t y, std::uint64_t tile_size,
+                                        const hictk::balancing::Method &normalization) const {
+  if (tile_size == 0) {
+    throw std::invalid_argument("tile_size should be a positive number");
+  }
+
+  const auto &bins = _fp->bins();
+  const auto num_tiles = (bins.size() + tile_size - 1) / tile_size;
+  if (x >= num_tiles || y >= num_tiles) {
+    throw std::out_of_range(fmt::format(
+        FMT_STRING("tile ({}, {}) is out of bounds: there are {} tiles along each axis"), x, y,
+        num_tiles));
+  }
+
+  const BinRange rows{x * tile_size, std::min(tile_size, bins.size() - (x * tile_size))};
+  const BinRange cols{y * tile_size, std::min(tile_size, bins.size() - (y * tile_size))};
+
+  std::vector<double> buffer(rows.size * cols.size);
+  DenseMatrixWriter<double> writer(buffer.data(), rows, cols,
+                                   hictk::transformers::QuerySpan::full, std::nullopt);
+
+  // As tiles are aligned to multiples of tile_size, rows and cols are either identical or
+  // disjoint: querying each pair of ranges with the range closest to the start of the genome
+  // first thus yields all the pixels overlapping the tile, and the writer takes care of mirroring
+  // pixels below the diagonal
+  const auto row_ranges = split_bin_range_by_chrom(bins, rows);
+  const auto col_ranges = split_bin_range_by_chrom(bins, cols);
+  for (const auto &r : row_ranges) {
+    for (const auto &c : col_ranges) {
+      const auto &[range1, range2] = r.second.offset <= c.second.offset ? std::tie(r, c)
+                                                                         : std::tie(c, r);
+      static_cast<void>(visit_selector(
+          *_fp, range1.first, range2.first, normalization, hictk::GenomicInterval::Type::BED,
+          [&](const auto &sel) {
+            return writer.write(sel.template begin<double>(), sel.template end<double>());
+          }));
+    }
+  }
+
+  // Pad the tile with NaNs when it extends past the end of the genome
+  std::vector<double> tile(tile_size * tile_size, std::numeric_limits<double>::quiet_NaN());
+  for (std::uint64_t j = 0; j < cols.size; ++j) {
+    const auto first = buffer.begin() + static_cast<std::ptrdiff_t>(j * rows.size);
+    std::copy(first, first + static_cast<std::ptrdiff_t>(rows.size),
+              tile.begin() + static_cast<std::ptrdiff_t>(j * tile_size));
+  }
+
+  return tile;
 }
 
 Rcpp::CharacterVector HiCFile::avail_normalizations() const {
   Rcpp::CharacterVector norms{};
-  for (const auto &norm : _fp.avail_normalizations()) {
+  for (const auto &norm : _fp->avail_normalizations()) {
     norms.push_back(norm.to_string());
   }
   return norms;
 }
+
+// Call fn with each pixel overlapping the upper triangle of the genome-wide matrix.
+// Pixels are reduced as soon as they are read, so that memory usage does not depend on the number
+// of interactions stored in the file
+template <typename Fn>
+static void for_each_genome_wide_pixel(const hictk::File &f,
+                                       const hictk::balancing::Method &normalization, Fn &&fn) {
+  std::visit(
+      [&](const auto &ff) {
+        const auto sel = ff.fetch(normalization);
+        const auto last = sel.template end<double>();
+        for (auto it = sel.template begin<double>(); it != last; ++it) {
+          fn(*it);
+        }
+      },
+      f.get());
+}
+
+// Map chromosome ids to the position of the corresponding chromosome in the table returned by
+// HiCFile::chromosomes(), which does not include the "All" chromosome of .hic files
+[[nodiscard]] static std::vector<std::size_t> get_chrom_offsets(const hictk::Reference &chroms) {
+  std::vector<std::size_t> offsets(chroms.size(), std::numeric_limits<std::size_t>::max());
+  std::size_t i = 0;
+  for (const auto &chrom : chroms) {
+    if (!chrom.is_all()) {
+      offsets[chrom.id()] = i++;
+    }
+  }
+  return offsets;
+}
+
+Rcpp::NumericVector HiCFile::marginals(Rcpp::Nullable<Rcpp::String> normalization) const {
+  Rcpp::NumericVector marginals(static_cast<R_xlen_t>(_fp->nbins()));
+  for_each_genome_wide_pixel(*_fp, to_hictk_normalization_method(normalization),
+                             [&](const auto &p) {
+                               // Interactions involving bins masked by the normalization are NaN
+                               if (!std::isfinite(p.count)) {
+                                 return;
+                               }
+                               marginals[static_cast<R_xlen_t>(p.bin1_id)] += p.count;
+                               if (p.bin1_id != p.bin2_id) {
+                                 marginals[static_cast<R_xlen_t>(p.bin2_id)] += p.count;
+                               }
+                             });
+  return marginals;
+}
+
+Rcpp::NumericVector HiCFile::cis_trans_summary() const {
+  const auto &bins = _fp->bins();
+  double cis_sum{};
+  double trans_sum{};
+  std::uint64_t cis_pixels{};
+  std::uint64_t trans_pixels{};
+
+  for_each_genome_wide_pixel(*_fp, hictk::balancing::Method::NONE(), [&](const auto &p) {
+    if (bins.at(p.bin1_id).chrom().id() == bins.at(p.bin2_id).chrom().id()) {
+      cis_sum += p.count;
+      ++cis_pixels;
+    } else {
+      trans_sum += p.count;
+      ++trans_pixels;
+    }
+  });
+
+  return Rcpp::NumericVector::create(
+      Rcpp::Named("cis") = cis_sum, Rcpp::Named("trans") = trans_sum,
+      Rcpp::Named("cis_pixels") = static_cast<double>(cis_pixels),
+      Rcpp::Named("trans_pixels") = static_cast<double>(trans_pixels));
+}
+
+Rcpp::NumericMatrix HiCFile::chrom_sums() const {
+  const auto &bins = _fp->bins();
+  const auto offsets = get_chrom_offsets(bins.chromosomes());
+
+  Rcpp::CharacterVector chrom_names{};
+  for (const auto &chrom : bins.chromosomes()) {
+    if (!chrom.is_all()) {
+      chrom_names.push_back(std::string{chrom.name()});
+    }
+  }
+
+  const auto nchroms = static_cast<int>(chrom_names.size());
+  Rcpp::NumericMatrix sums(nchroms, nchroms);
+  for_each_genome_wide_pixel(*_fp, hictk::balancing::Method::NONE(), [&](const auto &p) {
+    const auto i = static_cast<int>(offsets[bins.at(p.bin1_id).chrom().id()]);
+    const auto j = static_cast<int>(offsets[bins.at(p.bin2_id).chrom().id()]);
+    sums(i, j) += p.count;
+    if (i != j) {
+      sums(j, i) += p.count;
+    }
+  });
+
+  Rcpp::rownames(sums) = chrom_names;
+  Rcpp::colnames(sums) = chrom_names;
+
+  return sums;
+}
+
+namespace {
+// A square window of a pileup centered on the bins overlapping the midpoints of a pair of anchors.
+// Windows are always queried with chrom1 <= chrom2: windows whose anchors were swapped to satisfy
+// this constraint are transposed back when they are accumulated.
+struct PileupWindow {
+  std::uint32_t chrom1_id{};
+  std::uint32_t chrom2_id{};
+  BinRange rows{};
+  BinRange cols{};
+  bool transposed{};
+};
+
+// Per-cell sums of a set of pileup windows
+struct PileupAccumulator {
+  std::vector<double> sums{};
+  // Number of windows with a NaN value (e.g. due to bins masked by the normalization) in each cell
+  std::vector<std::uint64_t> nan_counts{};
+  std::uint64_t num_windows{};
+
+  PileupAccumulator() = default;
+  explicit PileupAccumulator(std::size_t size) : sums(size * size, 0.0), nan_counts(size * size) {}
+};
+}  // namespace
+
+// Return the windows overlapping the anchors listed in the first six columns of the given BEDPE.
+// Windows extending past the end of a chromosome are dropped.
+// Windows are sorted by chromosome pair and then by position, so that windows located on the same
+// pair of chromosomes can be processed by the same thread
+[[nodiscard]] static std::vector<PileupWindow> make_pileup_windows(const hictk::BinTable &bins,
+                                                                   const Rcpp::DataFrame &bedpe,
+                                                                   std::uint64_t flank) {
+  if (bedpe.size() < 6) {
+    throw std::invalid_argument("bedpe should have at least 6 columns");
+  }
+
+  const auto chroms1 = Rcpp::as<std::vector<std::string>>(bedpe[0]);
+  const auto starts1 = Rcpp::as<std::vector<double>>(bedpe[1]);
+  const auto ends1 = Rcpp::as<std::vector<double>>(bedpe[2]);
+  const auto chroms2 = Rcpp::as<std::vector<std::string>>(bedpe[3]);
+  const auto starts2 = Rcpp::as<std::vector<double>>(bedpe[4]);
+  const auto ends2 = Rcpp::as<std::vector<double>>(bedpe[5]);
+
+  // Return the range of bins centered on the midpoint of the given anchor, if any
+  auto center_window = [&](std::size_t i, const std::string &chrom_name, double start,
+                           double end) -> std::optional<BinRange> {
+    const auto &chrom = bins.chromosomes().at(chrom_name);
+    if (!(start >= 0) || !(end >= start) || end > chrom.size()) {
+      throw std::invalid_argument(
+          fmt::format(FMT_STRING("anchor #{} ({}:{}-{}) is not a valid genomic interval"), i + 1,
+                      chrom_name, start, end));
+    }
+    const auto midpoint = static_cast<std::uint32_t>((start + end) / 2);
+    const auto center = bins.at(chrom, std::min(midpoint, chrom.size() - 1));
+    const auto chrom_nbins = bins.at(chrom, chrom.size() - 1).rel_id() + 1;
+    if (center.rel_id() < flank || center.rel_id() + flank >= chrom_nbins) {
+      return {};
+    }
+    return BinRange{center.id() - flank, (2 * flank) + 1};
+  };
+
+  std::vector<PileupWindow> windows{};
+  windows.reserve(chroms1.size());
+  for (std::size_t i = 0; i < chroms1.size(); ++i) {
+    const auto rows = center_window(i, chroms1[i], starts1[i], ends1[i]);
+    const auto cols = center_window(i, chroms2[i], starts2[i], ends2[i]);
+    if (!rows.has_value() || !cols.has_value()) {
+      continue;
+    }
+
+    const auto chrom1_id = bins.chromosomes().at(chroms1[i]).id();
+    const auto chrom2_id = bins.chromosomes().at(chroms2[i]).id();
+    if (chrom1_id <= chrom2_id) {
+      windows.push_back(PileupWindow{chrom1_id, chrom2_id, *rows, *cols, false});
+    } else {
+      windows.push_back(PileupWindow{chrom2_id, chrom1_id, *cols, *rows, true});
+    }
+  }
+
+  std::sort(windows.begin(), windows.end(), [](const auto &w1, const auto &w2) {
+    return std::make_tuple(w1.chrom1_id, w1.chrom2_id, w1.rows.offset, w1.cols.offset) <
+           std::make_tuple(w2.chrom1_id, w2.chrom2_id, w2.rows.offset, w2.cols.offset);
+  });
+
+  return windows;
+}
+
+[[nodiscard]] static std::string bin_range_to_query(const hictk::BinTable &bins,
+                                                    const BinRange &range) {
+  const auto first_bin = bins.at(range.offset);
+  const auto last_bin = bins.at(range.offset + range.size - 1);
+  return fmt::format(FMT_STRING("{}:{}-{}"), first_bin.chrom().name(), first_bin.start(),
+                     last_bin.end());
+}
+
+// Add the interactions overlapping the given window to the accumulator.
+// buffer is used as scratch space and should be large enough to store a single window.
+// This function does not interact with the R API, and can thus be called from any thread
+static void accumulate_pileup_window(const hictk::File &f, const PileupWindow &window,
+                                     const hictk::balancing::Method &normalization_method,
+                                     const ExpectedTransform &exp_transform,
+                                     std::vector<double> &buffer, PileupAccumulator &acc) {
+  const auto &bins = f.bins();
+  const auto size = window.rows.size;
+  std::fill(buffer.begin(), buffer.end(), 0.0);
+
+  // Cis windows overlapping the diagonal are read by querying the smallest symmetric region
+  // containing the window, so that pixels from the lower triangle can be obtained by mirroring the
+  // upper triangle.
+  // All other windows are read by querying the window itself, swapping rows and columns when the
+  // window lies below the diagonal: pixels are then mirrored by the writer
+  std::string query1{};
+  std::string query2{};
+  const auto overlapping = window.chrom1_id == window.chrom2_id &&
+                           window.rows.offset < window.cols.offset + size &&
+                           window.cols.offset < window.rows.offset + size;
+  if (overlapping) {
+    const auto first_bin = std::min(window.rows.offset, window.cols.offset);
+    const auto last_bin = std::max(window.rows.offset, window.cols.offset) + size;
+    query1 = bin_range_to_query(bins, BinRange{first_bin, last_bin - first_bin});
+    query2 = query1;
+  } else if (window.chrom1_id == window.chrom2_id && window.rows.offset > window.cols.offset) {
+    query1 = bin_range_to_query(bins, window.cols);
+    query2 = bin_range_to_query(bins, window.rows);
+  } else {
+    query1 = bin_range_to_query(bins, window.rows);
+    query2 = bin_range_to_query(bins, window.cols);
+  }
+
+  DenseMatrixWriter<double> writer(buffer.data(), window.rows, window.cols,
+                                   hictk::transformers::QuerySpan::full, {});
+  static_cast<void>(visit_selector(
+      f, query1, query2, normalization_method, hictk::GenomicInterval::Type::BED,
+      [&](const auto &sel) {
+        return visit_pixels<double>(
+            sel, 1, [&](auto first, auto last) { return writer.write(first, last); },
+            exp_transform);
+      }));
+
+  for (std::size_t j = 0; j < size; ++j) {
+    for (std::size_t i = 0; i < size; ++i) {
+      const auto value = window.transposed ? buffer[j + (i * size)] : buffer[i + (j * size)];
+      if (std::isnan(value)) {
+        ++acc.nan_counts[i + (j * size)];
+      } else {
+        acc.sums[i + (j * size)] += value;
+      }
+    }
+  }
+  ++acc.num_windows;
+}
+
+Rcpp::NumericMatrix HiCFile::pileup(Rcpp::DataFrame bedpe, std::int64_t flank,
+                                    Rcpp::Nullable<Rcpp::String> normalization, std::string mode,
+                                    int threads) const {
+  if (flank < 0) {
+    throw std::invalid_argument("flank cannot be negative");
+  }
+  if (mode != "sum" && mode != "mean") {
+    throw std::invalid_argument("mode should be either \"sum\" or \"mean\"");
+  }
+  if (threads < 1) {
+    throw std::invalid_argument("threads should be a positive number");
+  }
+
+  constexpr auto max_flank = (std::numeric_limits<int>::max() - 1) / 2;
+  if (flank > max_flank) {
+    throw std::invalid_argument(
+        fmt::format(FMT_STRING("flank cannot be greater than {}"), max_flank));
+  }
+
+  const auto normalization_method = to_hictk_normalization_method(normalization);
+  const auto exp_transform = get_expected_transform(normalization_method, 1);
+  const auto size = static_cast<std::size_t>((2 * flank) + 1);
+  const auto windows = make_pileup_windows(_fp->bins(), bedpe, static_cast<std::uint64_t>(flank));
+
+  // Windows are grouped by chromosome pair. Each group is reduced into its own accumulator, so
+  // that the result does not depend on the order in which groups are processed
+  std::vector<std::size_t> group_offsets{0};
+  for (std::size_t i = 1; i < windows.size(); ++i) {
+    if (windows[i].chrom1_id != windows[i - 1].chrom1_id ||
+        windows[i].chrom2_id != windows[i - 1].chrom2_id) {
+      group_offsets.push_back(i);
+    }
+  }
+  group_offsets.push_back(windows.size());
+  const auto num_groups = windows.empty() ? std::size_t{0} : group_offsets.size() - 1;
+
+  std::vector<PileupAccumulator> accumulators(num_groups);
+  auto process_group = [&](const hictk::File &f, std::size_t i) {
+    std::vector<double> buffer(size * size);
+    PileupAccumulator acc(size);
+    for (auto j = group_offsets[i]; j < group_offsets[i + 1]; ++j) {
+      accumulate_pileup_window(f, windows[j], normalization_method, exp_transform, buffer, acc);
+    }
+    accumulators[i] = std::move(acc);
+  };
+
+  // See fetch_arrow_table() for why only .hic files are processed in parallel
+  if (threads > 1 && is_hic() && num_groups > 1) {
+    BS::thread_pool<> tpool(std::min(static_cast<std::size_t>(threads), num_groups));
+    for_each_chrom_pair_parallel(tpool, num_groups, [this]() { return open_handle(); },
+                                 process_group);
+  } else {
+    for (std::size_t i = 0; i < num_groups; ++i) {
+      process_group(*_fp, i);
+    }
+  }
+
+  PileupAccumulator total(size);
+  for (const auto &acc : accumulators) {
+    for (std::size_t i = 0; i < total.sums.size(); ++i) {
+      total.sums[i] += acc.sums[i];
+      total.nan_counts[i] += acc.nan_counts[i];
+    }
+    total.num_windows += acc.num_windows;
+  }
+
+  Rcpp::NumericMatrix matrix(static_cast<int>(size), static_cast<int>(size));
+  for (std::size_t i = 0; i < total.sums.size(); ++i) {
+    if (mode == "sum") {
+      matrix[static_cast<R_xlen_t>(i)] = total.sums[i];
+    } else {
+      const auto n = total.num_windows - total.nan_counts[i];
+      matrix[static_cast<R_xlen_t>(i)] = n == 0 ? std::numeric_limits<double>::quiet_NaN()
+                                                : total.sums[i] / static_cast<double>(n);
+    }
+  }
+  matrix.attr("num_windows") = static_cast<double>(total.num_windows);
+  matrix.attr("num_skipped") =
+      static_cast<double>(bedpe.nrow()) - static_cast<double>(total.num_windows);
+
+  return matrix;
+}
+
+template <typename Balancer>
+[[nodiscard]] static typename Balancer::Type parse_balancing_type(const std::string &type) {
+  if (type == "cis") {
+    return Balancer::Type::cis;
+  }
+  if (type == "trans") {
+    return Balancer::Type::trans;
+  }
+  if (type == "gw") {
+    return Balancer::Type::gw;
+  }
+  throw std::invalid_argument("type should be one of \"cis\", \"trans\", or \"gw\"");
+}
+
+// Compute balancing weights using one of the methods from hictk's balancing module.
+// When tmpfile is not empty, interactions are spilled to the given file instead of being kept in
+// memory. Weights are returned in multiplicative form (i.e., the form used by Cooler files)
+[[nodiscard]] static std::vector<double> compute_balancing_weights(
+    const hictk::File &f, const std::string &method, const std::string &type, std::size_t threads,
+    const std::filesystem::path &tmpfile) {
+  constexpr auto weight_type = hictk::balancing::Weights::Type::MULTIPLICATIVE;
+  return std::visit(
+      [&](const auto &ff) -> std::vector<double> {
+        if (method == "ICE") {
+          auto params = hictk::balancing::ICE::DefaultParams;
+          params.threads = threads;
+          params.tmpfile = tmpfile;
+          const hictk::balancing::ICE balancer(
+              ff, parse_balancing_type<hictk::balancing::ICE>(type), params);
+          return balancer.get_weights()(weight_type);
+        }
+        if (method == "SCALE") {
+          auto params = hictk::balancing::SCALE::DefaultParams;
+          params.threads = threads;
+          params.tmpfile = tmpfile;
+          const hictk::balancing::SCALE balancer(
+              ff, parse_balancing_type<hictk::balancing::SCALE>(type), params);
+          return balancer.get_weights()(weight_type);
+        }
+        if (method == "VC") {
+          const hictk::balancing::VC balancer(ff,
+                                              parse_balancing_type<hictk::balancing::VC>(type));
+          return balancer.get_weights()(weight_type);
+        }
+        throw std::invalid_argument("method should be one of \"ICE\", \"SCALE\", or \"VC\"");
+      },
+      f.get());
+}
+
+Rcpp::NumericVector HiCFile::balance(std::string method, std::string type, int threads,
+                                     std::string mode, bool write, std::string name, bool force) {
+  if (threads < 1) {
+    throw std::invalid_argument("threads should be a positive number");
+  }
+  if (mode != "in_memory" && mode != "out_of_core") {
+    throw std::invalid_argument("mode should be either \"in_memory\" or \"out_of_core\"");
+  }
+  if (write && !is_cooler()) {
+    throw std::invalid_argument("writing balancing weights is only supported for Cooler files");
+  }
+  if (write && name.empty()) {
+    throw std::invalid_argument("name cannot be empty");
+  }
+  if (write) {
+    // Handles are shared through the FileHandlePool: make sure that no other handle refers to the
+    // file (including handles opened at a different resolution of the same .mcool) before
+    // attempting to write to it
+    auto &pool = FileHandlePool::instance();
+    const std::string path{_fp->path()};
+    pool.invalidate(path);
+    if (_fp.use_count() > 1 || pool.count_live_handles(path, _fp.get()) != 0) {
+      throw std::runtime_error(fmt::format(
+          FMT_STRING("cannot write balancing weights to \"{}\": the file is still open in one or "
+                     "more File objects. Please remove them and call gc() before trying again"),
+          _fp->uri()));
+    }
+  }
+
+  const std::filesystem::path tmpfile =
+      mode == "in_memory"
+          ? std::filesystem::path{}
+          : std::filesystem::path{Rcpp::as<std::string>(Rcpp::Function("tempfile")(
+                "hictkR-balance-", Rcpp::Named("fileext") = ".bin"))};
+
+  std::vector<double> weights{};
+  try {
+    weights = compute_balancing_weights(*_fp, method, type, static_cast<std::size_t>(threads),
+                                        tmpfile);
+  } catch (...) {
+    std::error_code ec{};
+    std::filesystem::remove(tmpfile, ec);
+    throw;
+  }
+  std::error_code ec{};
+  std::filesystem::remove(tmpfile, ec);
+
+  if (write) {
+    // HDF5 cannot open a file for writing while it is still open in read-only mode: close the
+    // current handle before writing the weights, then re-open the file so that the new weights
+    // can be used by fetch()
+    // The file is re-opened even when writing the weights fails, so that this object remains
+    // usable
+    // MultiResFile and SingleCellFile objects keep their own handle to the file, which is not
+    // visible from here: when writing fails, point the user to them
+    const auto uri = _fp->uri();
+    auto reopen = [&]() {
+      const auto matrix_type = get_reader_matrix_type(uri, _matrix_type);
+      _fp = FileHandlePool::instance().open(uri, std::nullopt, matrix_type, _matrix_unit);
+    };
+    _fp.reset();
+    try {
+      hictk::cooler::File::write_weights(uri, name, weights.begin(), weights.end(), force);
+    } catch (const std::exception &e) {
+      reopen();
+      throw std::runtime_error(fmt::format(
+          FMT_STRING("failed to write balancing weights to \"{}\": {}\nNote that balancing weights "
+                     "cannot be written while the file is open in other File, MultiResFile, or "
+                     "SingleCellFile objects"),
+          uri, e.what()));
+    }
+    reopen();
+    _expected_values.clear();
+  }
+
+  return {weights.begin(), weights.end()};
+}
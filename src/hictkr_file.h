@@ -19,20 +19,58 @@
 #pragma once
 
 #include <Rcpp.h>
+#include <arrow/table.h>
 
 #include <cstdint>
+#include <hictk/balancing/methods.hpp>
 #include <hictk/cooler/cooler.hpp>
 #include <hictk/file.hpp>
 #include <hictk/hic.hpp>
+#include <map>
+#include <memory>
 #include <optional>
 #include <string>
+#include <vector>
+
+#include "./hictkr_expected.h"
+#include "./hictkr_fetch_future.h"
+#include "./hictkr_pixel_stream.h"
+
+class FetchProfiler;
 
 class HiCFile {
-  hictk::File _fp;
+  // Handles opened from a URI are shared through the FileHandlePool
+  std::shared_ptr<const hictk::File> _fp;
+  hictk::hic::MatrixType _matrix_type{hictk::hic::MatrixType::observed};
+  hictk::hic::MatrixUnit _matrix_unit{hictk::hic::MatrixUnit::BP};
+  // Bin tables can be large: build them lazily and only once per handle
+  mutable std::optional<Rcpp::DataFrame> _bins{};
+  // Computing expected values requires reading all pixels: cache them by normalization method
+  mutable std::map<std::string, std::shared_ptr<const ExpectedValues>> _expected_values{};
 
   HiCFile(std::string uri, std::optional<std::int64_t> resolution_, std::string matrix_type,
           std::string matrix_unit);
 
+  // Open a new handle to the file backing this object
+  [[nodiscard]] hictk::File open_handle() const;
+
+  [[nodiscard]] std::shared_ptr<const ExpectedValues> get_expected_values(
+      const hictk::balancing::Method &normalization) const;
+  // Return the transformation required to compute oe and expected matrices from Cooler files.
+  // The returned transformation leaves pixels untouched for observed matrices and .hic files
+  [[nodiscard]] ExpectedTransform get_expected_transform(
+      const hictk::balancing::Method &normalization, std::uint32_t coarsening_factor) const;
+  // Throw when pixels should be transformed by an ExpectedTransform, as this is only supported
+  // when fetching interactions as data frames, arrow streams, or dense matrices
+  void check_matrix_type_supported() const;
+
+  [[nodiscard]] std::shared_ptr<arrow::Table> fetch_arrow_table(
+      Rcpp::Nullable<Rcpp::String> range1, Rcpp::Nullable<Rcpp::String> range2,
+      Rcpp::Nullable<Rcpp::String> normalization, std::string count_type, bool join,
+      const std::string &query_type, const std::string &span,
+      Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+      Rcpp::Nullable<Rcpp::NumericVector> resolution, int threads, FetchProfiler *profiler) const;
+
  public:
   HiCFile() = delete;
   explicit HiCFile(std::string uri, std::string matrix_type = "observed",
@@ -55,16 +93,101 @@ class HiCFile {
   [[nodiscard]] std::uint64_t nchroms() const noexcept;
   [[nodiscard]] Rcpp::List attributes() const;
 
+  [[nodiscard]] Rcpp::DataFrame expected_values(Rcpp::Nullable<Rcpp::String> normalization) const;
+
+  // Summary statistics computed with a single pass over the pixels of the genome-wide matrix.
+  // Memory usage is proportional to the number of bins, not to the number of interactions
+  [[nodiscard]] Rcpp::NumericVector marginals(Rcpp::Nullable<Rcpp::String> normalization) const;
+  [[nodiscard]] Rcpp::NumericVector cis_trans_summary() const;
+  [[nodiscard]] Rcpp::NumericMatrix chrom_sums() const;
+
+  // Compute balancing weights, optionally writing them back to the file.
+  // Weights written to the file can be used straight away by fetch(normalization = name)
+  [[nodiscard]] Rcpp::NumericVector balance(std::string method, std::string type, int threads,
+                                            std::string mode, bool write, std::string name,
+                                            bool force);
+
+  // Aggregate the (2 * flank + 1) x (2 * flank + 1) windows centered on the anchor pairs listed in
+  // the given BEDPE
+  [[nodiscard]] Rcpp::NumericMatrix pileup(Rcpp::DataFrame bedpe, std::int64_t flank,
+                                           Rcpp::Nullable<Rcpp::String> normalization,
+                                           std::string mode, int threads) const;
+
   [[nodiscard]] Rcpp::DataFrame fetch_df(Rcpp::Nullable<Rcpp::String> range1,
                                          Rcpp::Nullable<Rcpp::String> range2,
                                          Rcpp::Nullable<Rcpp::String> normalization,
                                          std::string count_type, bool join,
-                                         std::string query_type) const;
+                                         std::string query_type, std::string span,
+                                         Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                         Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                         int threads, bool profile) const;
+
+  // Fetch interactions as a nanoarrow_array_stream
+  [[nodiscard]] Rcpp::RObject fetch_arrow(Rcpp::Nullable<Rcpp::String> range1,
+                                          Rcpp::Nullable<Rcpp::String> range2,
+                                          Rcpp::Nullable<Rcpp::String> normalization,
+                                          std::string count_type, bool join,
+                                          std::string query_type, std::string span,
+                                          Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                          Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                          int threads) const;
+
+  [[nodiscard]] Rcpp::RObject fetch_batch(Rcpp::CharacterVector range1,
+                                          Rcpp::Nullable<Rcpp::CharacterVector> range2,
+                                          Rcpp::Nullable<Rcpp::String> normalization,
+                                          std::string count_type, bool join,
+                                          std::string query_type, int threads, bool combine) const;
+
+  [[nodiscard]] PixelStream *fetch_stream(Rcpp::Nullable<Rcpp::String> range1,
+                                          Rcpp::Nullable<Rcpp::String> range2,
+                                          Rcpp::Nullable<Rcpp::String> normalization,
+                                          std::string count_type, bool join,
+                                          std::string query_type, std::int64_t chunk_size) const;
+
+  // Start fetching interactions as a DataFrame or dense matrix in the background.
+  // Queries targeting .hic files are processed by a worker thread using a dedicated file handle
+  [[nodiscard]] FetchFuture *fetch_async(Rcpp::Nullable<Rcpp::String> range1,
+                                         Rcpp::Nullable<Rcpp::String> range2,
+                                         Rcpp::Nullable<Rcpp::String> normalization,
+                                         std::string count_type, bool join,
+                                         std::string query_type, std::string span,
+                                         Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                         Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                         std::string type) const;
+
+  // Write interactions to the given file without materializing them in memory.
+  // Return the number of interactions that were written
+  [[nodiscard]] double fetch_to_file(std::string path, Rcpp::Nullable<Rcpp::String> range1,
+                                     Rcpp::Nullable<Rcpp::String> range2,
+                                     Rcpp::Nullable<Rcpp::String> normalization,
+                                     std::string count_type, bool join, std::string query_type,
+                                     std::string format, std::int64_t chunk_size,
+                                     bool force) const;
 
   [[nodiscard]] Rcpp::RObject fetch_dense(Rcpp::Nullable<Rcpp::String> range1,
                                           Rcpp::Nullable<Rcpp::String> range2,
                                           Rcpp::Nullable<Rcpp::String> normalization,
-                                          std::string count_type, std::string query_type) const;
+                                          std::string count_type, std::string query_type,
+                                          std::string span,
+                                          Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width,
+                                          bool band_storage,
+                                          Rcpp::Nullable<Rcpp::NumericVector> resolution,
+                                          int threads, bool profile) const;
+
+  [[nodiscard]] Rcpp::S4 fetch_sparse(Rcpp::Nullable<Rcpp::String> range1,
+                                      Rcpp::Nullable<Rcpp::String> range2,
+                                      Rcpp::Nullable<Rcpp::String> normalization,
+                                      std::string format, std::string query_type,
+                                      std::string span,
+                                      Rcpp::Nullable<Rcpp::NumericVector> diagonal_band_width) const;
+
+  // Fetch the genome-wide interactions overlapping the square tile with tile_size bins per side
+  // found at the given tile coordinates.
+  // Tiles are returned in column-major order, and are padded with NaNs when they extend past the
+  // end of the genome. This function does not interact with the R API
+  [[nodiscard]] std::vector<double> fetch_tile(std::uint64_t x, std::uint64_t y,
+                                               std::uint64_t tile_size,
+                                               const hictk::balancing::Method &normalization) const;
 
   [[nodiscard]] Rcpp::CharacterVector avail_normalizations() const;
 };
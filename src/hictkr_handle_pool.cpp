@@ -0,0 +1,206 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_handle_pool.h"
+
+#include <Rcpp.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <hictk/file.hpp>
+#include <hictk/hic/common.hpp>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+
+// Strip the group part from Cooler URIs (e.g. interactions.mcool::/resolutions/100000)
+[[nodiscard]] static std::string uri_to_path(const std::string &uri) {
+  return uri.substr(0, uri.find("::"));
+}
+
+[[nodiscard]] static std::string make_key(const std::string &uri,
+                                          std::optional<std::uint32_t> resolution,
+                                          hictk::hic::MatrixType matrix_type,
+                                          hictk::hic::MatrixUnit matrix_unit) {
+  return fmt::format(FMT_STRING("{}\t{}\t{}\t{}"), uri,
+                     resolution.has_value() ? static_cast<std::int64_t>(*resolution) : -1,
+                     static_cast<int>(matrix_type), static_cast<int>(matrix_unit));
+}
+
+// Return the modification time of the given file, or the epoch when the file cannot be stat'ed
+// (e.g. because it does not exist): in the latter case opening the file will fail anyway
+[[nodiscard]] static std::filesystem::file_time_type get_mtime(const std::string &path) {
+  std::error_code ec{};
+  const auto mtime = std::filesystem::last_write_time(path, ec);
+  if (ec) {
+    return {};
+  }
+  return mtime;
+}
+
+FileHandlePool &FileHandlePool::instance() {
+  static FileHandlePool pool{};
+  return pool;
+}
+
+std::shared_ptr<const hictk::File> FileHandlePool::open(const std::string &uri,
+                                                        std::optional<std::uint32_t> resolution,
+                                                        hictk::hic::MatrixType matrix_type,
+                                                        hictk::hic::MatrixUnit matrix_unit) {
+  auto key = make_key(uri, resolution, matrix_type, matrix_unit);
+  auto path = uri_to_path(uri);
+  const auto mtime = get_mtime(path);
+
+  if (auto match = _index.find(key); match != _index.end()) {
+    auto it = match->second;
+    if (it->mtime == mtime) {
+      ++_stats.hits;
+      _entries.splice(_entries.begin(), _entries, it);
+      return it->fp;
+    }
+    ++_stats.invalidations;
+    erase(it);
+  }
+
+  ++_stats.misses;
+  const auto t0 = clock::now();
+  auto fp = std::make_shared<const hictk::File>(uri, resolution, matrix_type, matrix_unit);
+  _stats.open_time += clock::now() - t0;
+  track(path, fp);
+
+  if (_capacity == 0) {
+    return fp;
+  }
+
+  while (_entries.size() >= _capacity) {
+    evict_lru();
+  }
+  _entries.push_front(Entry{key, std::move(path), mtime, fp});
+  _index.emplace(std::move(key), _entries.begin());
+
+  return fp;
+}
+
+void FileHandlePool::invalidate(const std::string &path) {
+  const auto path_ = uri_to_path(path);
+  for (auto it = _entries.begin(); it != _entries.end();) {
+    if (it->path == path_) {
+      ++_stats.invalidations;
+      it = erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+std::size_t FileHandlePool::count_live_handles(const std::string &path,
+                                               const hictk::File *ignore) {
+  const auto path_ = uri_to_path(path);
+  std::size_t count = 0;
+  const auto [first, last] = _live_handles.equal_range(path_);
+  for (auto it = first; it != last; ++it) {
+    const auto fp = it->second.lock();
+    if (!fp || fp.get() == ignore) {
+      continue;
+    }
+    // Do not count the references owned by fp and by the pool itself
+    const auto in_pool = std::any_of(_entries.begin(), _entries.end(),
+                                     [&](const Entry &entry) { return entry.fp == fp; });
+    if (fp.use_count() > (in_pool ? 2 : 1)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void FileHandlePool::clear() noexcept {
+  _index.clear();
+  _entries.clear();
+}
+
+std::size_t FileHandlePool::size() const noexcept { return _entries.size(); }
+
+std::size_t FileHandlePool::capacity() const noexcept { return _capacity; }
+
+void FileHandlePool::set_capacity(std::size_t capacity) {
+  _capacity = capacity;
+  while (_entries.size() > _capacity) {
+    evict_lru();
+  }
+}
+
+auto FileHandlePool::stats() const noexcept -> const Stats & { return _stats; }
+
+void FileHandlePool::reset_stats() noexcept { _stats = Stats{}; }
+
+void FileHandlePool::evict_lru() {
+  if (!_entries.empty()) {
+    ++_stats.evictions;
+    erase(std::prev(_entries.end()));
+  }
+}
+
+auto FileHandlePool::erase(std::list<Entry>::iterator it) -> std::list<Entry>::iterator {
+  _index.erase(it->key);
+  return _entries.erase(it);
+}
+
+void FileHandlePool::track(const std::string &path, const std::shared_ptr<const hictk::File> &fp) {
+  // Drop expired handles first, so that the list of live handles does not grow without bound
+  for (auto it = _live_handles.begin(); it != _live_handles.end();) {
+    it = it->second.expired() ? _live_handles.erase(it) : std::next(it);
+  }
+  _live_handles.emplace(path, fp);
+}
+
+Rcpp::List handle_pool_stats() {
+  const auto &pool = FileHandlePool::instance();
+  const auto &stats = pool.stats();
+
+  Rcpp::List r_stats{};
+  r_stats["hits"] = static_cast<double>(stats.hits);
+  r_stats["misses"] = static_cast<double>(stats.misses);
+  r_stats["evictions"] = static_cast<double>(stats.evictions);
+  r_stats["invalidations"] = static_cast<double>(stats.invalidations);
+  r_stats["open_time_ms"] = std::chrono::duration<double, std::milli>(stats.open_time).count();
+  r_stats["size"] = static_cast<double>(pool.size());
+  r_stats["capacity"] = static_cast<double>(pool.capacity());
+
+  return r_stats;
+}
+
+void set_handle_pool_size(std::int64_t size) {
+  if (size < 0) {
+    throw std::invalid_argument("size cannot be negative");
+  }
+  FileHandlePool::instance().set_capacity(static_cast<std::size_t>(size));
+}
+
+void clear_handle_pool() {
+  auto &pool = FileHandlePool::instance();
+  pool.clear();
+  pool.reset_stats();
+}
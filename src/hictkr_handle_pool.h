@@ -0,0 +1,105 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <hictk/file.hpp>
+#include <hictk/hic/common.hpp>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+// Process-wide cache of open file handles.
+// Opening a file requires reading its index (and for .hic files, the footer of each chromosome
+// pair): repeatedly calling File() on the same URI reuses the handle opened by the first call.
+// Handles are evicted in least-recently-used order, and are re-opened when the modification time
+// of the underlying file changes.
+// Handles are shared between all HiCFile objects created from the same URI: as R is
+// single-threaded, handles are never accessed concurrently.
+// The pool also keeps track of every handle it returned (including handles that have since been
+// evicted), so that we can tell whether a file is still open before trying to write to it.
+class FileHandlePool {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  struct Stats {
+    std::uint64_t hits{};
+    std::uint64_t misses{};
+    std::uint64_t evictions{};
+    std::uint64_t invalidations{};
+    clock::duration open_time{};
+  };
+
+ private:
+  struct Entry {
+    std::string key{};
+    std::string path{};
+    std::filesystem::file_time_type mtime{};
+    std::shared_ptr<const hictk::File> fp{};
+  };
+
+  std::list<Entry> _entries{};  // sorted from the most to the least recently used
+  std::unordered_map<std::string, std::list<Entry>::iterator> _index{};
+  std::unordered_multimap<std::string, std::weak_ptr<const hictk::File>> _live_handles{};
+  std::size_t _capacity{16};
+  Stats _stats{};
+
+  FileHandlePool() = default;
+
+ public:
+  [[nodiscard]] static FileHandlePool &instance();
+
+  // Return a handle to the file identified by the given parameters, opening the file only when no
+  // up-to-date handle is found in the pool
+  [[nodiscard]] std::shared_ptr<const hictk::File> open(const std::string &uri,
+                                                        std::optional<std::uint32_t> resolution,
+                                                        hictk::hic::MatrixType matrix_type,
+                                                        hictk::hic::MatrixUnit matrix_unit);
+  // Drop all handles referring to the file at the given path
+  void invalidate(const std::string &path);
+  // Count the handles returned by open() that refer to the file at the given path and are still
+  // alive (i.e. referenced by objects outside the pool), ignoring the given handle
+  [[nodiscard]] std::size_t count_live_handles(const std::string &path,
+                                               const hictk::File *ignore = nullptr);
+  void clear() noexcept;
+
+  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] std::size_t capacity() const noexcept;
+  // Setting the capacity to 0 disables the pool
+  void set_capacity(std::size_t capacity);
+
+  [[nodiscard]] const Stats &stats() const noexcept;
+  void reset_stats() noexcept;
+
+ private:
+  void evict_lru();
+  std::list<Entry>::iterator erase(std::list<Entry>::iterator it);
+  void track(const std::string &path, const std::shared_ptr<const hictk::File> &fp);
+};
+
+[[nodiscard]] Rcpp::List handle_pool_stats();
+void set_handle_pool_size(std::int64_t size);
+void clear_handle_pool();
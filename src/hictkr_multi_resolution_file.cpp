@@ -18,9 +18,24 @@
 
 #include "./hictkr_multi_resolution_file.h"
 
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/genomic_interval.hpp>
+#include <hictk/reference.hpp>
+#include <optional>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "./common.h"
+#include "./hictkr_file.h"
+#include "./hictkr_tile_cache.h"
 
 MultiResFile::MultiResFile(std::string path) : _fp(std::move(path)) {}
 
@@ -31,3 +46,143 @@ Rcpp::DataFrame MultiResFile::chromosomes() const { return get_chromosomes(_fp);
 Rcpp::IntegerVector MultiResFile::resolutions() const {
   return {_fp.resolutions().begin(), _fp.resolutions().end()};
 }
+
+const HiCFile &MultiResFile::open(std::uint32_t resolution) const {
+  auto match = _handles.find(resolution);
+  if (match == _handles.end()) {
+    match = _handles.try_emplace(resolution, _fp.path(), static_cast<std::int64_t>(resolution))
+                .first;
+  }
+  return match->second;
+}
+
+// Compute the number of bins overlapping the given query at the given resolution
+[[nodiscard]] static std::uint64_t count_bins(const hictk::Reference &chroms,
+                                              const Rcpp::Nullable<Rcpp::String> &query,
+                                              hictk::GenomicInterval::Type query_type,
+                                              std::uint32_t resolution) {
+  if (query.isNull()) {
+    std::uint64_t num_bins = 0;
+    for (const auto &chrom : chroms) {
+      if (!chrom.is_all()) {
+        num_bins += (chrom.size() + resolution - 1) / resolution;
+      }
+    }
+    return num_bins;
+  }
+
+  const auto gi =
+      hictk::GenomicInterval::parse(chroms, Rcpp::as<std::string>(query.get()), query_type);
+  const auto first_bin = gi.start() / resolution;
+  const auto last_bin = (gi.end() + resolution - 1) / resolution;
+  return std::max(std::uint64_t{1}, static_cast<std::uint64_t>(last_bin - first_bin));
+}
+
+std::uint32_t MultiResFile::select_resolution(const Rcpp::Nullable<Rcpp::String> &range1,
+                                              const Rcpp::Nullable<Rcpp::String> &range2,
+                                              double max_pixels,
+                                              const std::string &query_type) const {
+  if (!(max_pixels > 0)) {
+    throw std::invalid_argument("max_pixels should be a positive number");
+  }
+
+  const auto qt = query_type == "UCSC" ? hictk::GenomicInterval::Type::UCSC
+                                       : hictk::GenomicInterval::Type::BED;
+
+  auto resolutions = _fp.resolutions();
+  if (resolutions.empty()) {
+    throw std::runtime_error("file does not contain any resolution");
+  }
+  std::sort(resolutions.begin(), resolutions.end());
+
+  // The number of pixels is computed arithmetically from the query extent: this does not require
+  // opening the file at each resolution and is an upper bound on the number of non-zero pixels
+  for (const auto &resolution : resolutions) {
+    const auto num_rows = count_bins(_fp.chromosomes(), range1, qt, resolution);
+    const auto num_cols =
+        range2.isNull() ? num_rows : count_bins(_fp.chromosomes(), range2, qt, resolution);
+    if (static_cast<double>(num_rows) * static_cast<double>(num_cols) <= max_pixels) {
+      return resolution;
+    }
+  }
+
+  return resolutions.back();
+}
+
+Rcpp::List MultiResFile::fetch(Rcpp::Nullable<Rcpp::String> range1,
+                               Rcpp::Nullable<Rcpp::String> range2, double max_pixels,
+                               Rcpp::Nullable<Rcpp::String> normalization, std::string count_type,
+                               bool join, std::string query_type, std::string type) const {
+  if (type != "df" && type != "arrow" && type != "dense" && type != "sparse") {
+    throw std::invalid_argument(
+        "type should be one of \"df\", \"arrow\", \"dense\", or \"sparse\"");
+  }
+
+  const auto resolution = select_resolution(range1, range2, max_pixels, query_type);
+  const auto &f = open(resolution);
+
+  Rcpp::RObject interactions{};
+  if (type == "df") {
+    interactions = f.fetch_df(range1, range2, normalization, count_type, join, query_type,
+                              "upper_triangle", R_NilValue, R_NilValue, 1, false);
+  } else if (type == "arrow") {
+    interactions = f.fetch_arrow(range1, range2, normalization, count_type, join, query_type,
+                                 "upper_triangle", R_NilValue, R_NilValue, 1);
+  } else if (type == "dense") {
+    interactions = f.fetch_dense(range1, range2, normalization, count_type, query_type, "full",
+                                 R_NilValue, false, R_NilValue, 1, false);
+  } else {
+    interactions =
+        f.fetch_sparse(range1, range2, normalization, "dgCMatrix", query_type, "full", R_NilValue);
+  }
+
+  return Rcpp::List::create(Rcpp::Named("resolution") = resolution,
+                            Rcpp::Named("interactions") = interactions);
+}
+
+Rcpp::NumericMatrix MultiResFile::tile(std::int64_t z, std::int64_t x, std::int64_t y,
+                                       std::string normalization) const {
+  auto resolutions = _fp.resolutions();
+  std::sort(resolutions.begin(), resolutions.end(), std::greater<>{});
+
+  if (z < 0 || z >= static_cast<std::int64_t>(resolutions.size())) {
+    throw std::out_of_range(fmt::format(
+        FMT_STRING("zoom level should be between 0 and {}"), resolutions.size() - 1));
+  }
+  if (x < 0 || y < 0) {
+    throw std::out_of_range("tile coordinates cannot be negative");
+  }
+
+  const auto resolution = resolutions[static_cast<std::size_t>(z)];
+  if (normalization.empty()) {
+    normalization = "NONE";
+  }
+
+  // Checking the modification time of the file is cheap: do it on every call, so that tiles fetched
+  // before the file was modified (e.g. by balance()) are never returned
+  const auto mtime = std::filesystem::last_write_time(_fp.path());
+  if (_checksum.empty() || mtime != _checksum_mtime) {
+    _handles.clear();
+    _checksum = compute_file_checksum(_fp.path());
+    _checksum_mtime = mtime;
+  }
+  const auto key = fmt::format(FMT_STRING("{}\t{}\t{}\t{}\t{}\t{}"), _checksum, resolution,
+                               tile_size, normalization, x, y);
+
+  auto &cache = TileCache::instance();
+  auto tile = cache.get(key, tile_size * tile_size);
+  if (!tile.has_value()) {
+    const auto normalization_method = normalization == "NONE"
+                                          ? hictk::balancing::Method::NONE()
+                                          : hictk::balancing::Method{normalization};
+    tile = open(resolution).fetch_tile(static_cast<std::uint64_t>(x),
+                                       static_cast<std::uint64_t>(y), tile_size,
+                                       normalization_method);
+    cache.put(key, *tile);
+  }
+
+  Rcpp::NumericMatrix matrix(static_cast<int>(tile_size), static_cast<int>(tile_size),
+                             tile->begin());
+  matrix.attr("resolution") = resolution;
+  return matrix;
+}
@@ -21,11 +21,29 @@
 #include <Rcpp.h>
 
 #include <cstdint>
+#include <filesystem>
 #include <hictk/multires_file.hpp>
+#include <map>
 #include <string>
 
+#include "./hictkr_file.h"
+
 class MultiResFile {
   hictk::MultiResFile _fp;
+  // File handles are opened lazily and kept around for the lifetime of this object, so that
+  // repeated queries do not need to parse file headers and indexes over and over again
+  mutable std::map<std::uint32_t, HiCFile> _handles{};
+  // Checksum identifying the tiles fetched from this file, together with the modification time of
+  // the file when the checksum was computed. The checksum is re-computed by tile() whenever the
+  // file is modified
+  mutable std::string _checksum{};
+  mutable std::filesystem::file_time_type _checksum_mtime{};
+
+  [[nodiscard]] const HiCFile &open(std::uint32_t resolution) const;
+  [[nodiscard]] std::uint32_t select_resolution(const Rcpp::Nullable<Rcpp::String> &range1,
+                                                const Rcpp::Nullable<Rcpp::String> &range2,
+                                                double max_pixels,
+                                                const std::string &query_type) const;
 
  public:
   explicit MultiResFile(std::string path);
@@ -33,4 +51,20 @@ class MultiResFile {
   [[nodiscard]] std::string path() const;
   [[nodiscard]] Rcpp::DataFrame chromosomes() const;
   [[nodiscard]] Rcpp::IntegerVector resolutions() const;
+
+  // Fetch interactions at the finest resolution such that the number of pixels spanned by the
+  // query does not exceed max_pixels.
+  // Returns a list with the selected resolution and the interactions in the requested format.
+  [[nodiscard]] Rcpp::List fetch(Rcpp::Nullable<Rcpp::String> range1,
+                                 Rcpp::Nullable<Rcpp::String> range2, double max_pixels,
+                                 Rcpp::Nullable<Rcpp::String> normalization, std::string count_type,
+                                 bool join, std::string query_type, std::string type) const;
+
+  // Fetch a square tile of genome-wide interactions with tile_size x tile_size pixels.
+  // Zoom levels are mapped to the resolutions available in the file, starting from the coarsest
+  // resolution (zoom level 0). Tiles are cached using the process-wide TileCache.
+  [[nodiscard]] Rcpp::NumericMatrix tile(std::int64_t z, std::int64_t x, std::int64_t y,
+                                         std::string normalization) const;
+
+  static constexpr std::uint64_t tile_size{256};
 };
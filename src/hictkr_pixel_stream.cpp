@@ -0,0 +1,134 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_pixel_stream.h"
+
+#include <Rcpp.h>
+#include <arrow/table.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/file.hpp>
+#include <hictk/genomic_interval.hpp>
+#include <hictk/pixel.hpp>
+#include <hictk/transformers/to_dataframe.hpp>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "./hictkr_arrow.h"
+
+[[nodiscard]] static hictk::PixelSelector fetch_selector(
+    const hictk::File &f, const std::optional<std::string> &range1,
+    const std::optional<std::string> &range2, const hictk::balancing::Method &normalization_method,
+    hictk::GenomicInterval::Type query_type) {
+  if (!range1.has_value()) {
+    assert(!range2.has_value());
+    return f.fetch(normalization_method);
+  }
+  if (!range2.has_value() || *range1 == *range2) {
+    return f.fetch(*range1, normalization_method, query_type);
+  }
+  return f.fetch(*range1, *range2, normalization_method, query_type);
+}
+
+PixelStream::PixelStream(hictk::File fp, const std::optional<std::string> &range1,
+                         const std::optional<std::string> &range2,
+                         const hictk::balancing::Method &normalization_method, bool int_counts,
+                         bool join, hictk::GenomicInterval::Type query_type,
+                         std::size_t chunk_size)
+    : _fp(std::move(fp)),
+      _sel(fetch_selector(_fp, range1, range2, normalization_method, query_type)),
+      _pixels(int_counts ? decltype(_pixels){PixelRange<std::int32_t>{
+                               _sel.begin<std::int32_t>(), _sel.end<std::int32_t>()}}
+                         : decltype(_pixels){PixelRange<double>{_sel.begin<double>(),
+                                                                _sel.end<double>()}}),
+      _join(join),
+      _chunk_size(chunk_size) {
+  if (_chunk_size == 0) {
+    throw std::invalid_argument("chunk_size should be a positive number");
+  }
+}
+
+bool PixelStream::done() const {
+  return std::visit([](const auto &pixels) { return pixels.first == pixels.last; }, _pixels);
+}
+
+std::uint64_t PixelStream::chunk_size() const noexcept { return _chunk_size; }
+
+std::uint64_t PixelStream::chunks_read() const noexcept { return _chunks_read; }
+
+template <typename N>
+std::shared_ptr<arrow::Table> PixelStream::make_table(
+    const std::vector<hictk::ThinPixel<N>> &pixels) const {
+  const auto format = _join ? hictk::transformers::DataFrameFormat::BG2
+                            : hictk::transformers::DataFrameFormat::COO;
+
+  return hictk::transformers::ToDataFrame(pixels.begin(), pixels.end(), format, _sel.bins_ptr(),
+                                          hictk::transformers::QuerySpan::upper_triangle)();
+}
+
+template <typename N>
+std::shared_ptr<arrow::Table> PixelStream::read_chunk(PixelRange<N> &pixels) const {
+  std::vector<hictk::ThinPixel<N>> buffer{};
+  buffer.reserve(std::min(_chunk_size, std::size_t{256'000}));
+
+  for (; buffer.size() < _chunk_size && pixels.first != pixels.last; ++pixels.first) {
+    buffer.push_back(*pixels.first);
+  }
+
+  if (buffer.empty()) {
+    return nullptr;
+  }
+
+  return make_table(buffer);
+}
+
+std::shared_ptr<arrow::Table> PixelStream::next_table() {
+  auto table = std::visit([&](auto &pixels) { return read_chunk(pixels); }, _pixels);
+  if (table) {
+    ++_chunks_read;
+  }
+  return table;
+}
+
+std::shared_ptr<arrow::Schema> PixelStream::schema() const {
+  return std::visit(
+      [&](const auto &pixels) {
+        using N = std::decay_t<decltype((*pixels.first).count)>;
+        return make_table(std::vector<hictk::ThinPixel<N>>{})->schema();
+      },
+      _pixels);
+}
+
+Rcpp::RObject PixelStream::next_chunk() {
+  auto table = next_table();
+  if (!table) {
+    return R_NilValue;
+  }
+
+  return arrow_table_to_df(std::move(table));
+}
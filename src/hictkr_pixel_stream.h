@@ -0,0 +1,91 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+#include <arrow/table.h>
+#include <arrow/type.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/file.hpp>
+#include <hictk/genomic_interval.hpp>
+#include <hictk/pixel.hpp>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+// Iterate over the pixels overlapping a query in chunks of bounded size.
+// The file handle and PixelSelector backing the stream are owned by the stream itself, so that
+// iteration can resume where it stopped on each call to next_chunk().
+class PixelStream {
+  template <typename N>
+  using PixelIt = decltype(std::declval<const hictk::PixelSelector &>().template begin<N>());
+
+  template <typename N>
+  struct PixelRange {
+    PixelIt<N> first;
+    PixelIt<N> last;
+  };
+
+  hictk::File _fp;
+  hictk::PixelSelector _sel;
+  std::variant<PixelRange<std::int32_t>, PixelRange<double>> _pixels;
+  bool _join{};
+  std::size_t _chunk_size{};
+  std::size_t _chunks_read{};
+
+ public:
+  PixelStream(hictk::File fp, const std::optional<std::string> &range1,
+              const std::optional<std::string> &range2,
+              const hictk::balancing::Method &normalization_method, bool int_counts, bool join,
+              hictk::GenomicInterval::Type query_type, std::size_t chunk_size);
+
+  PixelStream(const PixelStream &other) = delete;
+  PixelStream(PixelStream &&other) noexcept = delete;
+  ~PixelStream() noexcept = default;
+  PixelStream &operator=(const PixelStream &other) = delete;
+  PixelStream &operator=(PixelStream &&other) noexcept = delete;
+
+  [[nodiscard]] bool done() const;
+  [[nodiscard]] std::uint64_t chunk_size() const noexcept;
+  [[nodiscard]] std::uint64_t chunks_read() const noexcept;
+
+  // Return the next chunk of pixels as a data.frame, or NULL once all pixels have been read
+  [[nodiscard]] Rcpp::RObject next_chunk();
+
+  // Same as next_chunk(), but return the chunk as an arrow::Table (or nullptr once all pixels have
+  // been read). This function does not interact with the R API
+  [[nodiscard]] std::shared_ptr<arrow::Table> next_table();
+  // Schema of the tables returned by next_table()
+  [[nodiscard]] std::shared_ptr<arrow::Schema> schema() const;
+
+ private:
+  template <typename N>
+  [[nodiscard]] std::shared_ptr<arrow::Table> read_chunk(PixelRange<N> &pixels) const;
+  template <typename N>
+  [[nodiscard]] std::shared_ptr<arrow::Table> make_table(
+      const std::vector<hictk::ThinPixel<N>> &pixels) const;
+};
+
+RCPP_EXPOSED_CLASS_NODECL(PixelStream)
@@ -0,0 +1,84 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_profiler.h"
+
+#include <Rcpp.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Read the number of bytes read by the current process through read()-like syscalls.
+// This includes reads served by the page cache.
+[[nodiscard]] static std::optional<std::uint64_t> read_process_bytes_read() {
+#ifdef __linux__
+  std::ifstream ifs("/proc/self/io");
+  std::string key{};
+  std::uint64_t value{};
+  while (ifs >> key >> value) {
+    if (key == "rchar:") {
+      return value;
+    }
+  }
+#endif
+  return {};
+}
+
+FetchProfiler::FetchProfiler() : _bytes_read_t0(read_process_bytes_read()) {}
+
+void FetchProfiler::add_counter(std::string name, double value) {
+  _counters.emplace_back(std::move(name), value);
+}
+
+void FetchProfiler::record_stage(const char *stage, clock::time_point t0) {
+  const std::chrono::duration<double, std::milli> elapsed = clock::now() - t0;
+  _stages.emplace_back(stage, elapsed.count());
+}
+
+[[nodiscard]] static Rcpp::NumericVector to_named_vector(
+    const std::vector<std::pair<std::string, double>> &values) {
+  Rcpp::NumericVector vect(static_cast<R_xlen_t>(values.size()));
+  Rcpp::CharacterVector names(static_cast<R_xlen_t>(values.size()));
+  for (std::size_t i = 0; i < values.size(); ++i) {
+    names[static_cast<R_xlen_t>(i)] = values[i].first;
+    vect[static_cast<R_xlen_t>(i)] = values[i].second;
+  }
+  vect.attr("names") = names;
+  return vect;
+}
+
+Rcpp::List FetchProfiler::to_list() const {
+  auto stages = _stages;
+  const std::chrono::duration<double, std::milli> elapsed = clock::now() - _t0;
+  stages.emplace_back("total", elapsed.count());
+
+  auto counters = _counters;
+  const auto bytes_read = read_process_bytes_read();
+  if (bytes_read.has_value() && _bytes_read_t0.has_value()) {
+    counters.emplace_back("bytes_read", static_cast<double>(*bytes_read - *_bytes_read_t0));
+  }
+
+  return Rcpp::List::create(Rcpp::Named("stages_ms") = to_named_vector(stages),
+                            Rcpp::Named("counters") = to_named_vector(counters));
+}
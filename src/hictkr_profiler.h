@@ -0,0 +1,77 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Collect a per-stage timing and counter breakdown of a query.
+// Profilers are meant to be passed around as nullable pointers: when profiling is disabled, the
+// only overhead is a null check at the boundary of each stage.
+class FetchProfiler {
+  using clock = std::chrono::steady_clock;
+
+  std::vector<std::pair<std::string, double>> _stages{};
+  std::vector<std::pair<std::string, double>> _counters{};
+  clock::time_point _t0{clock::now()};
+  std::optional<std::uint64_t> _bytes_read_t0{};
+
+ public:
+  FetchProfiler();
+
+  // Run fn and record its wall-clock time under the given stage name
+  template <typename Fn>
+  auto time(const char *stage, Fn &&fn) {
+    const auto t0 = clock::now();
+    if constexpr (std::is_void_v<decltype(fn())>) {
+      fn();
+      record_stage(stage, t0);
+    } else {
+      auto res = fn();
+      record_stage(stage, t0);
+      return res;
+    }
+  }
+
+  void add_counter(std::string name, double value);
+
+  // Return a list with the time spent in each stage (in milliseconds) and the counters collected
+  // while processing the query.
+  // Bytes read are only reported on platforms exposing per-process I/O counters (e.g. Linux).
+  [[nodiscard]] Rcpp::List to_list() const;
+
+ private:
+  void record_stage(const char *stage, clock::time_point t0);
+};
+
+// Run fn, timing it as the given stage when profiler is not null
+template <typename Fn>
+auto profile_stage(FetchProfiler *profiler, const char *stage, Fn &&fn) {
+  if (!profiler) {
+    return fn();
+  }
+  return profiler->time(stage, std::forward<Fn>(fn));
+}
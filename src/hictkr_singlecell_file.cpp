@@ -18,12 +18,31 @@
 
 #include "./hictkr_singlecell_file.h"
 
+#include <Rcpp.h>
+#include <arrow/table.h>
+#include <fmt/format.h>
+
 #include <cstdint>
+#include <functional>
+#include <hictk/balancing/methods.hpp>
+#include <hictk/cooler/cooler.hpp>
 #include <hictk/cooler/singlecell_cooler.hpp>
+#include <hictk/genomic_interval.hpp>
+#include <hictk/pixel.hpp>
+#include <hictk/transformers/to_dataframe.hpp>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "./common.h"
+#include "./hictkr_arrow.h"
 
 SingleCellFile::SingleCellFile(std::string path) : _fp(std::move(path)) {}
 
@@ -35,7 +54,15 @@ std::uint64_t SingleCellFile::nbins() const noexcept { return _fp.bins().size();
 
 Rcpp::DataFrame SingleCellFile::chromosomes() const { return get_chromosomes(_fp); }
 
-Rcpp::DataFrame SingleCellFile::bins() const { return get_bins(_fp); }
+Rcpp::DataFrame SingleCellFile::bins() const {
+  if (!_bins.has_value()) {
+    _bins = get_bins(_fp);
+    mark_not_mutable(*_bins);
+  }
+  // Return a shallow copy so that changes to the attributes of the returned data.frame
+  // (e.g. its names) do not affect the cached bin table
+  return Rcpp::DataFrame{Rf_shallow_duplicate(*_bins)};
+}
 
 Rcpp::List SingleCellFile::attributes() const {
   Rcpp::List r_attrs{};
@@ -109,3 +136,166 @@ Rcpp::List SingleCellFile::attributes() const {
 Rcpp::CharacterVector SingleCellFile::cells() const {
   return {_fp.cells().begin(), _fp.cells().end()};
 }
+
+[[nodiscard]] static hictk::cooler::PixelSelector fetch_selector(
+    const hictk::cooler::File &clr, const std::optional<std::string> &range1,
+    const std::optional<std::string> &range2, const hictk::balancing::Method &normalization_method,
+    hictk::GenomicInterval::Type query_type) {
+  if (!range1.has_value()) {
+    return clr.fetch(normalization_method);
+  }
+  if (!range2.has_value() || *range1 == *range2) {
+    return clr.fetch(*range1, normalization_method, query_type);
+  }
+  return clr.fetch(*range1, *range2, normalization_method, query_type);
+}
+
+template <typename N>
+[[nodiscard]] static std::shared_ptr<arrow::Table> make_arrow_df(
+    const std::vector<hictk::ThinPixel<N>> &pixels, bool join,
+    const std::shared_ptr<const hictk::BinTable> &bins) {
+  const auto format =
+      join ? hictk::transformers::DataFrameFormat::BG2 : hictk::transformers::DataFrameFormat::COO;
+  return hictk::transformers::ToDataFrame(pixels.begin(), pixels.end(), format, bins,
+                                          hictk::transformers::QuerySpan::upper_triangle)();
+}
+
+// Merge pixels from k sorted pixel iterators using a min-heap, summing the counts of pixels that
+// overlap the same pair of bins.
+template <typename N, typename PixelIt>
+[[nodiscard]] static std::vector<hictk::ThinPixel<N>> merge_pixels(
+    std::vector<std::pair<PixelIt, PixelIt>> ranges) {
+  using Sum = std::conditional_t<std::is_integral_v<N>, std::int64_t, double>;
+  // (bin1_id, bin2_id, index of the range the pixel comes from)
+  using Node = std::tuple<std::uint64_t, std::uint64_t, std::size_t>;
+  std::priority_queue<Node, std::vector<Node>, std::greater<>> heap{};
+
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    if (ranges[i].first != ranges[i].second) {
+      const auto &p = *ranges[i].first;
+      heap.emplace(p.bin1_id, p.bin2_id, i);
+    }
+  }
+
+  std::vector<hictk::ThinPixel<N>> pixels{};
+  auto emit = [&](std::uint64_t bin1_id, std::uint64_t bin2_id, Sum count) {
+    if constexpr (std::is_integral_v<N>) {
+      if (count > std::numeric_limits<N>::max()) {
+        throw std::overflow_error(
+            fmt::format(FMT_STRING("aggregated count for pixel {}:{} does not fit in a 32-bit "
+                                   "integer: please use count_type=\"float\""),
+                        bin1_id, bin2_id));
+      }
+    }
+    pixels.push_back(hictk::ThinPixel<N>{bin1_id, bin2_id, static_cast<N>(count)});
+  };
+
+  std::optional<std::pair<std::uint64_t, std::uint64_t>> current{};
+  Sum count{};
+  while (!heap.empty()) {
+    const auto [bin1_id, bin2_id, i] = heap.top();
+    heap.pop();
+
+    auto &[first, last] = ranges[i];
+    const auto coords = std::make_pair(bin1_id, bin2_id);
+    if (current != coords) {
+      if (current.has_value()) {
+        emit(current->first, current->second, count);
+      }
+      current = coords;
+      count = 0;
+    }
+    count += static_cast<Sum>((*first).count);
+
+    if (++first != last) {
+      const auto &p = *first;
+      heap.emplace(p.bin1_id, p.bin2_id, i);
+    }
+  }
+
+  if (current.has_value()) {
+    emit(current->first, current->second, count);
+  }
+
+  return pixels;
+}
+
+Rcpp::RObject SingleCellFile::fetch(Rcpp::Nullable<Rcpp::CharacterVector> cells,
+                                    Rcpp::Nullable<Rcpp::String> range1,
+                                    Rcpp::Nullable<Rcpp::String> range2,
+                                    Rcpp::Nullable<Rcpp::String> normalization,
+                                    std::string count_type, bool join, std::string query_type,
+                                    bool aggregate) const {
+  const auto normalization_method =
+      normalization.isNull() || Rcpp::as<std::string>(normalization) == "NONE"
+          ? hictk::balancing::Method::NONE()
+          : hictk::balancing::Method{Rcpp::as<std::string>(normalization)};
+  if (normalization_method != "NONE" && count_type == "int") {
+    count_type = "float";
+  }
+
+  const auto cell_names =
+      cells.isNull() ? std::vector<std::string>{_fp.cells().begin(), _fp.cells().end()}
+                     : Rcpp::as<std::vector<std::string>>(cells.get());
+  if (cell_names.empty()) {
+    throw std::invalid_argument("cells should contain at least one cell");
+  }
+
+  const auto range1_str =
+      range1.isNull() ? std::optional<std::string>{} : Rcpp::as<std::string>(range1);
+  const auto range2_str =
+      range2.isNull() ? range1_str : std::optional<std::string>{Rcpp::as<std::string>(range2)};
+  const auto qt = query_type == "UCSC" ? hictk::GenomicInterval::Type::UCSC
+                                       : hictk::GenomicInterval::Type::BED;
+
+  // The HDF5 library used by hictk is not thread-safe, so cells are always read sequentially.
+  // All cells share the bin table of the .scool file.
+  auto fetch_pixels = [&](auto count) -> Rcpp::RObject {
+    using N = decltype(count);
+    using PixelIt =
+        decltype(std::declval<const hictk::cooler::PixelSelector &>().template begin<N>());
+
+    if (aggregate) {
+      // The k-way merge requires all cells to be open at the same time
+      std::vector<hictk::cooler::File> clrs{};
+      std::vector<hictk::cooler::PixelSelector> selectors{};
+      clrs.reserve(cell_names.size());
+      selectors.reserve(cell_names.size());
+      for (const auto &cell : cell_names) {
+        clrs.emplace_back(_fp.open(cell));
+        selectors.emplace_back(
+            fetch_selector(clrs.back(), range1_str, range2_str, normalization_method, qt));
+      }
+      const auto bins = selectors.front().bins_ptr();
+
+      std::vector<std::pair<PixelIt, PixelIt>> ranges{};
+      ranges.reserve(selectors.size());
+      for (const auto &sel : selectors) {
+        ranges.emplace_back(sel.template begin<N>(), sel.template end<N>());
+      }
+      return arrow_table_to_df(make_arrow_df(merge_pixels<N>(std::move(ranges)), join, bins));
+    }
+
+    // Cells are opened, converted and closed one at a time, so that only a single cell is ever
+    // open at any given time
+    Rcpp::List dfs(static_cast<R_xlen_t>(cell_names.size()));
+    for (std::size_t i = 0; i < cell_names.size(); ++i) {
+      const auto clr = _fp.open(cell_names[i]);
+      const auto sel = fetch_selector(clr, range1_str, range2_str, normalization_method, qt);
+      const std::vector<hictk::ThinPixel<N>> pixels(sel.template begin<N>(),
+                                                    sel.template end<N>());
+      dfs[static_cast<R_xlen_t>(i)] =
+          arrow_table_to_df(make_arrow_df(pixels, join, sel.bins_ptr()));
+    }
+    dfs.attr("names") = cell_names;
+    return dfs;
+  };
+
+  if (count_type == "int") {
+    return fetch_pixels(std::int32_t{});
+  }
+  if (count_type == "float32") {
+    return fetch_pixels(float{});
+  }
+  return fetch_pixels(double{});
+}
@@ -22,10 +22,13 @@
 
 #include <cstdint>
 #include <hictk/cooler/singlecell_cooler.hpp>
+#include <optional>
 #include <string>
 
 class SingleCellFile {
   hictk::cooler::SingleCellFile _fp;
+  // Bin tables can be large: build them lazily and only once per handle
+  mutable std::optional<Rcpp::DataFrame> _bins{};
 
  public:
   explicit SingleCellFile(std::string path);
@@ -37,4 +40,14 @@ class SingleCellFile {
   [[nodiscard]] Rcpp::DataFrame bins() const;
   [[nodiscard]] Rcpp::List attributes() const;
   [[nodiscard]] Rcpp::CharacterVector cells() const;
+
+  // Fetch interactions for the given cells (or all cells when cells is NULL).
+  // When aggregate is true, interactions from all cells are summed into a single pseudo-bulk
+  // DataFrame. Otherwise, a list with one DataFrame per cell is returned.
+  [[nodiscard]] Rcpp::RObject fetch(Rcpp::Nullable<Rcpp::CharacterVector> cells,
+                                    Rcpp::Nullable<Rcpp::String> range1,
+                                    Rcpp::Nullable<Rcpp::String> range2,
+                                    Rcpp::Nullable<Rcpp::String> normalization,
+                                    std::string count_type, bool join, std::string query_type,
+                                    bool aggregate) const;
 };
@@ -0,0 +1,293 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#include "./hictkr_tile_cache.h"
+
+#include <Rcpp.h>
+#include <fmt/format.h>
+#include <zstd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+// 64-bit FNV-1a hash. Hashes are persisted on disk: std::hash cannot be used, as its value is
+// not guaranteed to be stable across builds
+[[nodiscard]] static std::uint64_t fnv1a(const char *data, std::size_t size,
+                                         std::uint64_t hash = 0xcbf29ce484222325ULL) {
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<std::uint8_t>(data[i]);
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+std::string compute_file_checksum(const std::filesystem::path &path) {
+  constexpr std::size_t region_size = 4ULL << 20U;
+
+  const auto file_size = std::filesystem::file_size(path);
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("unable to open file \"{}\" for reading"), path.string()));
+  }
+
+  const auto mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+  const auto header = fmt::format(FMT_STRING("{}\t{}"), mtime, file_size);
+  auto hash = fnv1a(header.data(), header.size());
+
+  std::vector<char> buffer(region_size);
+  auto hash_region = [&](std::uint64_t offset, std::size_t size) {
+    ifs.seekg(static_cast<std::streamoff>(offset));
+    ifs.read(buffer.data(), static_cast<std::streamsize>(size));
+    if (!ifs) {
+      throw std::runtime_error(
+          fmt::format(FMT_STRING("failed to read file \"{}\""), path.string()));
+    }
+    hash = fnv1a(buffer.data(), size, hash);
+  };
+
+  hash_region(0, static_cast<std::size_t>(std::min<std::uintmax_t>(file_size, region_size)));
+  if (file_size > region_size) {
+    const auto offset = std::max<std::uintmax_t>(region_size, file_size - region_size);
+    hash_region(offset, static_cast<std::size_t>(file_size - offset));
+  }
+
+  return fmt::format(FMT_STRING("{:016x}"), hash);
+}
+
+[[nodiscard]] static std::string compress_tile(const std::vector<double> &tile) {
+  const auto src_size = tile.size() * sizeof(double);
+  std::string data(ZSTD_compressBound(src_size), '\0');
+  const auto size = ZSTD_compress(data.data(), data.size(), tile.data(), src_size, 3);
+  if (ZSTD_isError(size)) {
+    throw std::runtime_error(
+        fmt::format(FMT_STRING("failed to compress tile: {}"), ZSTD_getErrorName(size)));
+  }
+  data.resize(size);
+  data.shrink_to_fit();
+  return data;
+}
+
+// Return nothing when data is not a valid tile with the expected number of values
+[[nodiscard]] static std::optional<std::vector<double>> decompress_tile(const std::string &data,
+                                                                        std::size_t num_values) {
+  std::vector<double> tile(num_values);
+  const auto dest_size = num_values * sizeof(double);
+  const auto size = ZSTD_decompress(tile.data(), dest_size, data.data(), data.size());
+  if (ZSTD_isError(size) || size != dest_size) {
+    return {};
+  }
+  return tile;
+}
+
+TileCache &TileCache::instance() {
+  static TileCache cache{};
+  return cache;
+}
+
+std::optional<std::vector<double>> TileCache::get(const std::string &key,
+                                                  std::size_t num_values) {
+  if (auto match = _index.find(key); match != _index.end()) {
+    auto tile = decompress_tile(match->second->data, num_values);
+    if (tile.has_value()) {
+      ++_stats.memory_hits;
+      _entries.splice(_entries.begin(), _entries, match->second);
+      return tile;
+    }
+  }
+
+  if (auto data = read_from_disk(key); data.has_value()) {
+    auto tile = decompress_tile(*data, num_values);
+    if (tile.has_value()) {
+      ++_stats.disk_hits;
+      insert(key, std::move(*data));
+      return tile;
+    }
+  }
+
+  ++_stats.misses;
+  return {};
+}
+
+void TileCache::put(const std::string &key, const std::vector<double> &tile) {
+  if (_max_memory_usage == 0 && _dir.empty()) {
+    return;
+  }
+
+  auto data = compress_tile(tile);
+  write_to_disk(key, data);
+  insert(key, std::move(data));
+}
+
+void TileCache::configure(std::size_t max_memory_usage, std::filesystem::path dir) {
+  if (!dir.empty()) {
+    std::filesystem::create_directories(dir);
+  }
+  _dir = std::move(dir);
+  _max_memory_usage = max_memory_usage;
+  evict();
+}
+
+void TileCache::clear() noexcept {
+  _index.clear();
+  _entries.clear();
+  _memory_usage = 0;
+}
+
+std::size_t TileCache::size() const noexcept { return _entries.size(); }
+
+std::size_t TileCache::memory_usage() const noexcept { return _memory_usage; }
+
+std::size_t TileCache::max_memory_usage() const noexcept { return _max_memory_usage; }
+
+const std::filesystem::path &TileCache::dir() const noexcept { return _dir; }
+
+auto TileCache::stats() const noexcept -> const Stats & { return _stats; }
+
+void TileCache::reset_stats() noexcept { _stats = Stats{}; }
+
+std::filesystem::path TileCache::tile_path(const std::string &key) const {
+  return _dir / fmt::format(FMT_STRING("{:016x}.tile"), fnv1a(key.data(), key.size()));
+}
+
+// Tiles are stored on disk as the length of the key (as a 64-bit integer in native byte order),
+// followed by the key and by the compressed tile. Keys are checked when reading tiles back, so
+// that hash collisions are detected.
+std::optional<std::string> TileCache::read_from_disk(const std::string &key) const {
+  if (_dir.empty()) {
+    return {};
+  }
+
+  std::ifstream ifs(tile_path(key), std::ios::binary);
+  if (!ifs) {
+    return {};
+  }
+
+  std::uint64_t key_size{};
+  ifs.read(reinterpret_cast<char *>(&key_size), sizeof(key_size));  // NOLINT
+  if (!ifs || key_size != key.size()) {
+    return {};
+  }
+
+  std::string stored_key(key.size(), '\0');
+  ifs.read(stored_key.data(), static_cast<std::streamsize>(stored_key.size()));
+  if (!ifs || stored_key != key) {
+    return {};
+  }
+
+  std::string data{std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>()};
+  return data;
+}
+
+void TileCache::write_to_disk(const std::string &key, const std::string &data) const {
+  if (_dir.empty()) {
+    return;
+  }
+
+  // Tiles are first written to a temporary file and then renamed, so that other processes sharing
+  // the same cache never read partially-written tiles
+  const auto path = tile_path(key);
+  auto tmp_path = path;
+  tmp_path += fmt::format(FMT_STRING(".{:016x}.tmp"), std::random_device{}());
+
+  {
+    std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+    const auto key_size = static_cast<std::uint64_t>(key.size());
+    ofs.write(reinterpret_cast<const char *>(&key_size), sizeof(key_size));  // NOLINT
+    ofs.write(key.data(), static_cast<std::streamsize>(key.size()));
+    ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!ofs) {
+      std::error_code ec{};
+      std::filesystem::remove(tmp_path, ec);
+      throw std::runtime_error(
+          fmt::format(FMT_STRING("failed to write tile to \"{}\""), tmp_path.string()));
+    }
+  }
+
+  std::error_code ec{};
+  std::filesystem::rename(tmp_path, path, ec);
+  if (ec) {
+    std::filesystem::remove(tmp_path, ec);
+  }
+}
+
+void TileCache::insert(const std::string &key, std::string data) {
+  if (_max_memory_usage == 0) {
+    return;
+  }
+
+  if (auto match = _index.find(key); match != _index.end()) {
+    _memory_usage -= match->second->data.size();
+    _entries.erase(match->second);
+    _index.erase(match);
+  }
+
+  _memory_usage += data.size();
+  _entries.push_front(Entry{key, std::move(data)});
+  _index.emplace(key, _entries.begin());
+  evict();
+}
+
+void TileCache::evict() {
+  while (!_entries.empty() && _memory_usage > _max_memory_usage) {
+    const auto &entry = _entries.back();
+    _memory_usage -= entry.data.size();
+    _index.erase(entry.key);
+    _entries.pop_back();
+  }
+}
+
+Rcpp::List tile_cache_stats() {
+  const auto &cache = TileCache::instance();
+  const auto &stats = cache.stats();
+
+  Rcpp::List r_stats{};
+  r_stats["memory_hits"] = static_cast<double>(stats.memory_hits);
+  r_stats["disk_hits"] = static_cast<double>(stats.disk_hits);
+  r_stats["misses"] = static_cast<double>(stats.misses);
+  r_stats["size"] = static_cast<double>(cache.size());
+  r_stats["memory_usage"] = static_cast<double>(cache.memory_usage());
+  r_stats["max_memory_usage"] = static_cast<double>(cache.max_memory_usage());
+  r_stats["dir"] = cache.dir().string();
+
+  return r_stats;
+}
+
+void configure_tile_cache(double max_memory_usage, std::string dir) {
+  if (!(max_memory_usage >= 0)) {
+    throw std::invalid_argument("memory_size should be a non-negative number");
+  }
+  TileCache::instance().configure(static_cast<std::size_t>(max_memory_usage), std::move(dir));
+}
+
+void clear_tile_cache() {
+  auto &cache = TileCache::instance();
+  cache.clear();
+  cache.reset_stats();
+}
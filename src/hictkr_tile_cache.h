@@ -0,0 +1,98 @@
+// Copyright (C) 2025 Roberto Rossini <roberros@uio.no>
+//
+// SPDX-License-Identifier: GPL-2.0-or-later
+//
+// This library is free software: you can redistribute it and/or
+// modify it under the terms of the GNU Public License as published
+// by the Free Software Foundation; either version 3 of the License,
+// or (at your option) any later version.
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// Library General Public License for more details.
+//
+// You should have received a copy of the GNU Public License along
+// with this library.  If not, see
+// <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <Rcpp.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Compute a checksum identifying the given version of a file.
+// To keep the cost of computing checksums for large files bounded, the file is not hashed in its
+// entirety: the checksum is computed from the modification time and size of the file, and from its
+// first and last few MBs. Files that are modified in place (e.g. when writing balancing weights to
+// an .mcool file) are thus detected through their modification time.
+[[nodiscard]] std::string compute_file_checksum(const std::filesystem::path &path);
+
+// Process-wide cache of dense tiles.
+// Tiles are compressed with zstd and stored in memory (up to a configurable number of bytes,
+// evicting tiles in least-recently-used order) and, optionally, in a folder on disk so that they
+// can be shared across R sessions. Tile keys should include the checksum of the file from which
+// tiles were fetched, so that tiles fetched from outdated files are never returned.
+class TileCache {
+ public:
+  struct Stats {
+    std::uint64_t memory_hits{};
+    std::uint64_t disk_hits{};
+    std::uint64_t misses{};
+  };
+
+ private:
+  struct Entry {
+    std::string key{};
+    std::string data{};  // compressed tile
+  };
+
+  std::list<Entry> _entries{};  // sorted from the most to the least recently used
+  std::unordered_map<std::string, std::list<Entry>::iterator> _index{};
+  std::size_t _memory_usage{};
+  std::size_t _max_memory_usage{64ULL << 20U};
+  std::filesystem::path _dir{};
+  Stats _stats{};
+
+  TileCache() = default;
+
+ public:
+  [[nodiscard]] static TileCache &instance();
+
+  // Return the tile with the given key, or nothing if the tile is not cached
+  [[nodiscard]] std::optional<std::vector<double>> get(const std::string &key,
+                                                       std::size_t num_values);
+  void put(const std::string &key, const std::vector<double> &tile);
+
+  // Setting max_memory_usage to 0 disables the in-memory cache, while an empty dir disables the
+  // on-disk cache
+  void configure(std::size_t max_memory_usage, std::filesystem::path dir);
+  // Drop all tiles cached in memory. Tiles cached on disk are left untouched
+  void clear() noexcept;
+
+  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] std::size_t memory_usage() const noexcept;
+  [[nodiscard]] std::size_t max_memory_usage() const noexcept;
+  [[nodiscard]] const std::filesystem::path &dir() const noexcept;
+  [[nodiscard]] const Stats &stats() const noexcept;
+  void reset_stats() noexcept;
+
+ private:
+  [[nodiscard]] std::filesystem::path tile_path(const std::string &key) const;
+  [[nodiscard]] std::optional<std::string> read_from_disk(const std::string &key) const;
+  void write_to_disk(const std::string &key, const std::string &data) const;
+  void insert(const std::string &key, std::string data);
+  void evict();
+};
+
+[[nodiscard]] Rcpp::List tile_cache_stats();
+void configure_tile_cache(double max_memory_usage, std::string dir);
+void clear_tile_cache();
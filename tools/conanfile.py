@@ -149,6 +149,7 @@ class HictkConan(ConanFile):
     def configure(self):
         self.options["arrow"].compute = True
         self.options["arrow"].filesystem_layer = False
+        self.options["arrow"].ipc = True
         self.options["arrow"].parquet = False
         self.options["arrow"].with_boost = False
         self.options["arrow"].with_re2 = True
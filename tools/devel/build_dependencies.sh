@@ -66,4 +66,13 @@ for build_type in Release Debug; do
     -s build_type=Release \
     --output-folder "$stage_dir/$build_type" \
     -g CMakeDeps
+
+  # Only required when configuring with -DHICTKR_ENABLE_BENCHMARKS=ON
+  conan install \
+    --requires="benchmark/1.9.4" \
+    -pr:a "$(basename "$CC")" \
+    --build=missing \
+    -s build_type=Release \
+    --output-folder "$stage_dir/$build_type" \
+    -g CMakeDeps
 done